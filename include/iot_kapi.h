@@ -11,6 +11,44 @@
 #include "iot_error.h"
 
 
+//Memory allocator statistics
+
+#define IOT_MEMSTATS_NUMLISTS 16 //15 freelists of memory allocator plus one pseudo-list (last) for direct allocations
+
+struct iot_memstats_list_t { //counters for one size class (freelist) of thread memory allocator
+	uint32_t objsize; //size of blocks in list (including header). zero for pseudo-list of direct allocations
+	uint32_t chunks; //number of OS-allocated chunks carved into blocks of this list (for direct allocations - number of blocks in use)
+	uint64_t allocs; //total number of allocated blocks
+	uint64_t hits; //number of allocations satisfied from freelist
+	uint64_t misses; //number of allocations which found freelist empty and had to request memory from OS
+	uint64_t releases; //total number of released blocks
+	uint64_t remote_releases; //number of blocks released from thread other than owner of allocator
+	uint64_t infly; //number of blocks in use now
+	uint64_t freeblocks; //number of blocks in freelist now
+	uint64_t freebytes; //number of bytes held in freelist now
+};
+
+struct iot_memstats_t { //statistics of memory allocator of one thread
+	int32_t totalinfly; //total number of blocks in use
+	uint32_t memchunks; //number of OS-allocated chunks held by allocator
+	uint64_t chunkbytes; //total size of OS-allocated chunks carved into freelist blocks
+	uint64_t arenabytes; //total size of regions reserved by mmap() arena (zero if arena is disabled)
+	uint64_t arenaused; //number of bytes of arena regions given out to freelist chunks
+	iot_memstats_list_t lists[IOT_MEMSTATS_NUMLISTS];
+};
+
+//Fills provided struct with statistics of memory allocator of specified thread (current thread if zero). Values are approximate when allocator
+//is being used by its thread concurrently. Must be called in main thread.
+//Returns 0 on success or negative error code:
+//IOT_ERROR_INVALID_ARGS - st is NULL
+//IOT_ERROR_NOT_FOUND - thread is unknown
+int kapi_get_memstats(uv_thread_t thread, iot_memstats_t* st);
+
+//Requests every thread to log memory blocks currently in use by its allocator. In debug build blocks are grouped by allocation backtrace with
+//count, total size and age of oldest block for each group. Reports are output asynchronously by corresponding threads. Must be called in main thread.
+void kapi_report_memblocks(void);
+
+
 //Event subscription
 
 
@@ -377,6 +377,30 @@ struct iot_module_instance_base {
 	//IOT_ERROR_TEMPORARY_ERROR - just request to recreate instance after some time due to some temporary error.
 	int kapi_self_abort(int errcode);
 
+	//runs 'work' in kernel pool of threads for blocking operations (file system access, name resolution, long computations), so that they do not delay
+	//other instances of working thread. 'done' is then called in instance thread with status 0, or with IOT_ERROR_ACTION_CANCELLED if instance was stopped
+	//meanwhile (in such case it must only release 'arg'). Instance is not deinited and not moved to another thread until all its jobs are done.
+	//'work' runs outside of kernel threads, so it must not call kapi functions (except kapi_outlog_*() macros) or use iot_allocate_memblock(). iot_release_memblock()
+	//can be used, blocks released there are returned directly to free list of owning allocator.
+	//Can be called from start() and while instance is working.
+	//Return values:
+	//0 - success, 'done' will be called
+	//IOT_ERROR_INVALID_ARGS - 'work' or 'done' is NULL
+	//IOT_ERROR_NOT_READY - instance is not started or is being stopped
+	//IOT_ERROR_LIMIT_REACHED - too many pending jobs of instance
+	//IOT_ERROR_NO_MEMORY
+	int kapi_run_blocking(void (*work)(void* arg), void (*done)(void* arg, int status), void* arg);
+
+	//starts (or restarts) one-shot timer served by kernel timing wheel of instance thread. 'timer' must be inited with notify function, which is called in
+	//instance thread after 'delay' milliseconds. Non-zero 'slack' allows kernel to delay signal by up to 'slack' milliseconds, so that timers of all instances
+	//of thread which fall into common window are signalled in single wakeup. Timer is stopped by timer.unschedule() and must be stopped in stop().
+	//Instances with such timers started between calls must not have is_migratable flag.
+	//Return values:
+	//0 - success
+	//IOT_ERROR_INVALID_ARGS - timer has no notify function
+	//IOT_ERROR_INVALID_THREAD - called not in instance thread
+	int kapi_timer_start(iot_atimer_item &timer, uint64_t delay, uint64_t slack=0);
+
 
 
 	//Called to start work of previously inited instance.
@@ -556,7 +580,10 @@ struct iot_devifaces_list {
 struct iot_iface_device_driver_t {
 	uint32_t //num_devclassids:4,					//number of classes of data in state struct and number of items in stclassids list in this struct. can be 0 if driver can only be used directly in same bundle
 			num_hwdevcontypes:4,					//number of items in hwdevcontypes array in this struct. can be zero if hwdevices with any contype must be tried
-			cpu_loading:2;						//average level of cpu loading of started driver instance. 0 - minimal loading (unlimited such tasks can work in same working thread), 3 - very high loading (this module requires separate working thread per instance)
+			cpu_loading:2,						//average level of cpu loading of started driver instance. 0 - minimal loading (unlimited such tasks can work in same working thread), 3 - very high loading (this module requires separate working thread per instance)
+			is_migratable:1,					//flag that started instance keeps no handles or other state bound to its thread or event loop between calls, so kernel can move it
+												//to another working thread without restart (instance's 'thread' and 'loop' are updated). instances without this flag are moved by restart (rarely)
+			is_realtime:1;						//flag that instance is latency-critical and should work in thread with real-time priority (if such threads are enabled in setup)
 
 	const iot_hwdev_localident** hwdevcontypes;		//pointer to array (with num_devcontypes items) of device connection types this module can probe. i.e. module knows how to check hwdevice identity for such contypes.
 
@@ -700,7 +727,7 @@ struct iot_iface_node_t {
 			cpu_loading:2,						//average level of cpu loading of started instance. 0 - minimal loading (unlimited number of such tasks can work
 												//in same working thread), 3 - very high loading (this module requires separate working thread per instance)
 			is_persistent:1,					//flag that node is persistent (event source or executor). otherwise (when 0) it is operator
-			is_sync:1;							//flag that node (with at least one explicit output) can and promises to transform input signals into output explicitly
+			is_sync:1,							//flag that node (with at least one explicit output) can and promises to transform input signals into output explicitly
 												//and unambiguously. i.e. after getting notification about input signals update such node must either give corresponding
 												//output signals immediately (or say 'no change') or give promise to answer later. such nodes can generate output
 												//signals unrelated to inputs change BUT they must be ready for loosing intermediate signals (i.e. in series of
@@ -711,6 +738,9 @@ struct iot_iface_node_t {
 												//bypassing thread message queue and gives outputs directly to event processing routine. This greatly speeds up
 												//processing. But simple mode is disabled when instance gives delayed answer or generates unrelated signal for the
 												//first time
+			is_migratable:1,					//flag that started instance keeps no handles or other state bound to its thread or event loop between calls, so kernel can move it
+												//to another working thread without restart (instance's 'thread' and 'loop' are updated). instances without this flag are never moved
+			is_realtime:1;						//flag that instance is latency-critical and should work in thread with real-time priority (if such threads are enabled in setup)
 	iot_deviceconn_filter_t devcfg[IOT_CONFIG_MAX_NODE_DEVICES];
 
 	iot_node_valuelinkcfg_t valueoutput[IOT_CONFIG_MAX_NODE_VALUEOUTPUTS]; //describes type of value for corresponding labeled VALUE output.
@@ -4,6 +4,9 @@
 #include <assert.h>
 #include <stddef.h>
 #include <stdlib.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 
 #define ECB_NO_LIBM
 #include "ecb.h"
@@ -351,8 +354,70 @@ struct iot_membuf_chain {
 		}
 		return c;
 	}
+	unsigned count_segments(uint32_t offset, uint32_t datalen) const { //counts number of bufs which hold data range [offset; offset+datalen)
+		const iot_membuf_chain *p=this;
+		while(p && offset>=p->len) {
+			offset-=p->len;
+			p=p->next;
+		}
+		unsigned c=0;
+		while(p && datalen>0) {
+			uint32_t sz=p->len-offset;
+			datalen = datalen>sz ? datalen-sz : 0;
+			offset=0;
+			c++;
+			p=p->next;
+		}
+		return c;
+	}
+	//fills up to maxbufs scatter-gather descriptors (struct iovec or uv_buf_t) for data range [offset; offset+datalen) of chain.
+	//range is truncated to chain's total_len. returns number of filled descriptors. if covered is not NULL, it gets number of bytes
+	//described by filled descriptors (can be less than datalen if maxbufs is not enough)
+#ifndef _WIN32
+	unsigned fill_iovec(struct iovec* iov, unsigned maxbufs, uint32_t offset, uint32_t datalen, uint32_t* covered=NULL) const {
+		return fill_bufs(iov, maxbufs, offset, datalen, covered, [](struct iovec* v, char* base, uint32_t sz)->void{v->iov_base=base;v->iov_len=sz;});
+	}
+#endif
+	unsigned fill_uvbufs(uv_buf_t* bufs, unsigned maxbufs, uint32_t offset, uint32_t datalen, uint32_t* covered=NULL) const {
+		return fill_bufs(bufs, maxbufs, offset, datalen, covered, [](uv_buf_t* v, char* base, uint32_t sz)->void{*v=uv_buf_init(base, sz);});
+	}
+private:
+	template<class B, class F> unsigned fill_bufs(B* bufs, unsigned maxbufs, uint32_t offset, uint32_t datalen, uint32_t* covered, F setbuf) const {
+		const iot_membuf_chain *p=this;
+		while(p && offset>=p->len) {
+			offset-=p->len;
+			p=p->next;
+		}
+		unsigned c=0;
+		uint32_t total=0;
+		while(p && datalen>0 && c<maxbufs) {
+			uint32_t sz=p->len-offset;
+			if(sz>datalen) sz=datalen;
+			setbuf(&bufs[c], const_cast<char*>(p->buf)+offset, sz);
+			total+=sz;
+			datalen-=sz;
+			offset=0;
+			c++;
+			p=p->next;
+		}
+		if(covered) *covered=total;
+		return c;
+	}
 };
 
+//Scatter-gather I/O over iot_membuf_chain. Data range [offset; offset+datalen) of chain is transferred without intermediate copying.
+#ifndef _WIN32
+//Writes data range of chain to (possibly non-blocking) fd, repeating writev() on partial writes until all data is written, EAGAIN or error.
+//Returns number of written bytes (can be less than datalen if EAGAIN was got) or negative errno value if error occured before any byte was written
+ssize_t iot_membuf_chain_writev(int fd, const iot_membuf_chain* chain, uint32_t offset, uint32_t datalen);
+//Reads up to maxlen bytes from fd into chain starting at offset with readv() calls until space is filled, EOF, EAGAIN or error.
+//Returns number of read bytes (0 on EOF or EAGAIN when nothing was read) or negative errno value if error occured before any byte was read
+ssize_t iot_membuf_chain_readv(int fd, iot_membuf_chain* chain, uint32_t offset, uint32_t maxlen);
+#endif
+//Starts uv_write() of data range of chain. Chain must stay valid (not released) until cb is called.
+//Returns 0 on success or negative libuv error code
+int iot_membuf_chain_uvwrite(uv_write_t* req, uv_stream_t* stream, const iot_membuf_chain* chain, uint32_t offset, uint32_t datalen, uv_write_cb cb);
+
 //abstraction class over uv_timer_t
 class iot_timer {
 	uv_timer_t timer;
@@ -412,7 +477,7 @@ public:
 
 class iot_atimer_item;
 class iot_atimer_item {
-	friend class iot_atimer;
+	friend class iot_timerwheel;
 	iot_atimer_item *next, *prev;
 	uint64_t timesout; //corelates with result of uv_now, so is not unix time
 public:
@@ -430,7 +495,7 @@ public:
 		param=param_;
 		next=prev=NULL;
 	}
-	void unschedule(void) { //should not be called in thread other than of corresponding iot_atimer object
+	void unschedule(void) { //should not be called in thread other than of corresponding iot_timerwheel object
 		BILINKLISTWT_REMOVE(this, next, prev);
 	}
 	bool is_on(void) { //checks if timer is scheduled
@@ -441,74 +506,169 @@ public:
 	}
 };
 
-//Action timer which works with uv library. Manages queue of EQUAL relative timer events (period is set during init) using minimal resources. Size of queue is unlimited
-class iot_atimer {
-	iot_atimer_item *head, *tail;
+#define IOT_TIMERWHEEL_BITS 6
+#define IOT_TIMERWHEEL_SLOTS (1u<<IOT_TIMERWHEEL_BITS)
+#define IOT_TIMERWHEEL_LEVELS 4
+
+//Hierarchical timing wheel which works with uv library. Schedules any number of iot_atimer_item objects with arbitrary delays using single uv timer.
+//Time is split into ticks of equal length (set during init). Level 0 has slot for each of nearest IOT_TIMERWHEEL_SLOTS ticks, every next level has slots
+//IOT_TIMERWHEEL_SLOTS times longer, whose items are moved to lower level when their slot is reached. Items signal not earlier than requested and not
+//later than one tick after it. Items with longer delays than covered by all levels are kept in last slot and rescheduled when it is reached.
+//Scheduling and unscheduling cost O(1), uv timer is started only for ticks with due items or items to be moved between levels.
+//Items with slack are delayed to tick aligned to largest power of two ticks not exceeding slack, so timers with overlapping windows signal in single wakeup.
+class iot_timerwheel {
+	struct slot_t {
+		iot_atimer_item *head, *tail;
+	} slots[IOT_TIMERWHEEL_LEVELS][IOT_TIMERWHEEL_SLOTS];
+	uint64_t occupied[IOT_TIMERWHEEL_LEVELS]; //bit mask of non-empty slots for every level. can have bits of slots emptied by unschedule() of items
 	uv_timer_t timer;
 	uv_thread_t thread;
-	uint64_t period; //zero if no timer inited
+	uint64_t tick; //length of tick in milliseconds, zero if no timer inited
+	uint64_t curtick; //number of last processed tick (uv_now()/tick)
+	uint64_t armedtick; //tick for which uv timer is started or zero
+
+	static_assert(IOT_TIMERWHEEL_SLOTS==64, "bit masks of occupied slots must have bit for each slot");
+
 public:
-	iot_atimer(void) {
-		period=0;
+	iot_timerwheel(void) {
+		tick=0;
 	}
-	~iot_atimer(void) {
+	~iot_timerwheel(void) {
 		deinit();
 	}
-	void init(uint64_t period_, uv_loop_t *loop) {
-		assert(period==0); //forbid double init
+	void init(uint64_t tick_, uv_loop_t *loop) {
+		assert(tick==0); //forbid double init
 		assert(loop!=NULL);
 		thread=uv_thread_self();
 
-		if(period_==0) period_=1;
-		head=tail=NULL;
+		if(tick_==0) tick_=1;
+		memset(slots, 0, sizeof(slots));
+		memset(occupied, 0, sizeof(occupied));
 		uv_timer_init(loop, &timer);
 		timer.data=this;
 
-		period=period_;
-		uv_timer_start(&timer, iot_atimer::ontimer, period_, period_);
+		tick=tick_;
+		curtick=uv_now(loop)/tick;
+		armedtick=0;
 	}
 	void set_thread(uv_thread_t thread_) {
 		thread=thread_;
 	}
 	void deinit(void) {
-		if(period) {
-			while(head)
-				head->unschedule(); //here head is moved to next item!!!
+		if(tick) {
+			for(unsigned l=0;l<IOT_TIMERWHEEL_LEVELS;l++)
+				for(unsigned i=0;i<IOT_TIMERWHEEL_SLOTS;i++)
+					while(slots[l][i].head)
+						slots[l][i].head->unschedule(); //here head is moved to next item!!!
 			uv_close((uv_handle_t*)&timer, NULL);
-			period=0;
+			tick=0;
 		}
 	}
-	static void ontimer(uv_timer_t *w) {
-		iot_atimer* th=(iot_atimer*)w->data;
-
-		uint64_t now=uv_now(w->loop);
-		//loop through all items in queue while they seems to be timed out
-		iot_atimer_item * cur;
-		iot_atimer_item * &head=th->head;
-		while(head && head->timesout <= now) {
-			cur=head;
-			cur->unschedule(); //here head is moved to next item!!!
-			//signal about timeout
-			cur->notify(cur->param);
-		}
-		if(head) { //restart timer
-			uv_timer_set_repeat(w, head->timesout - now);
-		} else {
-			if(uv_timer_get_repeat(w)==th->period) return; //optimization actual for libuv to avoid unnecessary calls which already done before this callback
-			uv_timer_set_repeat(w, th->period);
-		}
-		uv_timer_again(w);
-	}
-	void schedule(iot_atimer_item &it) {
+	void schedule(iot_atimer_item &it, uint64_t delay, uint64_t slack=0) { //schedules item to signal after delay milliseconds but not later than
+																			//after delay+slack milliseconds (plus one tick)
 		assert(thread==uv_thread_self());
-		assert(period!=0);
+		assert(tick!=0);
 		assert(it.notify!=NULL);
 		if(expect_false(!it.notify)) return;
 
 		it.unschedule();
-		it.timesout=uv_now(timer.loop)+period;
-		//add to the tail
-		BILINKLISTWT_INSERTTAIL(&it, head, tail, next, prev);
+		uint64_t now=uv_now(timer.loop);
+		if(curtick<now/tick && is_empty()) curtick=now/tick; //no items are scheduled, so just skip passed ticks
+		it.timesout=now+delay;
+		uint64_t exptick=(it.timesout+tick-1)/tick;
+		if(slack>=tick) {
+			uint64_t align=uint64_t(1)<<ecb_ld64(slack/tick); //largest power of two not greater than slack in ticks
+			exptick=(exptick+align-1) & ~(align-1);
+			it.timesout=exptick*tick; //so that item keeps aligned tick when moved between levels
+		}
+		if(exptick<=curtick) exptick=curtick+1;
+		insert(it, exptick);
+		if(!armedtick || exptick<armedtick) arm(exptick);
+	}
+
+private:
+	static uint64_t rotr(uint64_t mask, unsigned shift) {
+		shift&=IOT_TIMERWHEEL_SLOTS-1;
+		return shift ? (mask>>shift) | (mask<<(IOT_TIMERWHEEL_SLOTS-shift)) : mask;
+	}
+	void insert(iot_atimer_item &it, uint64_t exptick) { //exptick must not be less than curtick
+		uint64_t diff=exptick-curtick;
+		unsigned l=0;
+		while(l<IOT_TIMERWHEEL_LEVELS-1 && diff>=(uint64_t(1)<<((l+1)*IOT_TIMERWHEEL_BITS))) l++;
+		uint64_t maxdiff=(uint64_t(1)<<(IOT_TIMERWHEEL_LEVELS*IOT_TIMERWHEEL_BITS))-1;
+		if(diff>maxdiff) exptick=curtick+maxdiff; //beyond last level. item will be reinserted when slot is reached
+		unsigned idx=unsigned(exptick>>(l*IOT_TIMERWHEEL_BITS)) & (IOT_TIMERWHEEL_SLOTS-1);
+		slot_t &slot=slots[l][idx];
+		BILINKLISTWT_INSERTTAIL(&it, slot.head, slot.tail, next, prev);
+		occupied[l]|=uint64_t(1)<<idx;
+	}
+	void cascade(unsigned l) { //moves items of current slot of level l to lower levels
+		unsigned idx=unsigned(curtick>>(l*IOT_TIMERWHEEL_BITS)) & (IOT_TIMERWHEEL_SLOTS-1);
+		slot_t &slot=slots[l][idx];
+		occupied[l]&=~(uint64_t(1)<<idx);
+		iot_atimer_item* cur;
+		while((cur=slot.head)) {
+			cur->unschedule(); //here head is moved to next item!!!
+			uint64_t exptick=(cur->timesout+tick-1)/tick;
+			insert(*cur, exptick<curtick ? curtick : exptick);
+		}
+	}
+	bool is_empty(void) const {
+		for(unsigned l=0;l<IOT_TIMERWHEEL_LEVELS;l++) if(occupied[l]) return false;
+		return true;
+	}
+	uint64_t next_tick(void) { //finds nearest tick with due items or items to be moved to lower level. returns zero if there are no items
+		uint64_t best=0;
+		for(unsigned l=0;l<IOT_TIMERWHEEL_LEVELS;l++) {
+			unsigned shift=l*IOT_TIMERWHEEL_BITS;
+			uint64_t base=(curtick>>shift)+1; //nearest slot of level which can contain items
+			while(occupied[l]) {
+				unsigned k=ecb_ctz64(rotr(occupied[l], unsigned(base)));
+				unsigned idx=unsigned(base+k) & (IOT_TIMERWHEEL_SLOTS-1);
+				if(!slots[l][idx].head) { //slot was emptied by unschedule()
+					occupied[l]&=~(uint64_t(1)<<idx);
+					continue;
+				}
+				uint64_t t=(base+k)<<shift;
+				if(!best || t<best) best=t;
+				break;
+			}
+		}
+		return best;
+	}
+	void arm(uint64_t exptick) {
+		uint64_t now=uv_now(timer.loop);
+		armedtick=exptick;
+		uv_timer_start(&timer, iot_timerwheel::ontimer, exptick*tick>now ? exptick*tick-now : 0, 0);
+	}
+	static void ontimer(uv_timer_t *w) {
+		iot_timerwheel* wh=(iot_timerwheel*)w->data;
+		uint64_t nowtick=uv_now(w->loop)/wh->tick;
+		wh->armedtick=0;
+
+		while(wh->curtick<nowtick) {
+			if(wh->is_empty()) {
+				wh->curtick=nowtick;
+				break;
+			}
+			wh->curtick++;
+			//move items of reached slots of upper levels down
+			for(unsigned l=1;l<IOT_TIMERWHEEL_LEVELS;l++) {
+				if(wh->curtick & ((uint64_t(1)<<(l*IOT_TIMERWHEEL_BITS))-1)) break;
+				wh->cascade(l);
+			}
+			unsigned idx=unsigned(wh->curtick) & (IOT_TIMERWHEEL_SLOTS-1);
+			slot_t &slot=wh->slots[0][idx];
+			wh->occupied[0]&=~(uint64_t(1)<<idx);
+			iot_atimer_item* cur;
+			while((cur=slot.head)) {
+				cur->unschedule(); //here head is moved to next item!!!
+				//signal about timeout
+				cur->notify(cur->param); //can schedule items again, which always go to later ticks
+			}
+		}
+		uint64_t t=wh->next_tick();
+		if(t && (!wh->armedtick || t<wh->armedtick)) wh->arm(t); //timer could be already started by schedule() during notifications
 	}
 };
 
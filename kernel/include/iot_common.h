@@ -6,6 +6,7 @@
 #include <atomic>
 #include <sched.h>
 #include <assert.h>
+#include <string.h>
 
 //#include<time.h>
 
@@ -46,6 +47,113 @@
 }
 
 
+//places in code which busy-wait for other threads. contention statistics is collected for every site
+enum iot_spinsite_t : uint8_t {
+	IOT_SPINSITE_MPSC_POP,			//mpsc_queue::pop() waits for push in progress
+	IOT_SPINSITE_MPSC_POPALL,		//mpsc_queue::pop_all() waits for push in progress
+	IOT_SPINSITE_DEVCONN_LOCK,		//iot_device_connection_t::lock()
+	IOT_SPINSITE_MODINST_LOCK,		//iot_modinstance_item_t::lock(), unlock() and mark_pendfree()
+
+	IOT_SPINSITE_NUM
+};
+
+struct iot_spinsite_stats_t { //updated when wait is finished
+	volatile std::atomic<uint64_t> contended; //number of waits which were not satisfied immediately
+	volatile std::atomic<uint64_t> pauses; //total number of executed pause instructions
+	volatile std::atomic<uint64_t> yields; //total number of sched_yield() calls
+	volatile std::atomic<uint64_t> parks; //total number of times thread was parked by futex
+};
+extern iot_spinsite_stats_t iot_spinstats[IOT_SPINSITE_NUM];
+const char* iot_spinsite_name(iot_spinsite_t site);
+
+//number of backoff rounds with pause instructions. number of pauses is doubled every round
+#define IOT_SPIN_PAUSEROUNDS 7
+//number of backoff rounds with sched_yield() after pause rounds. after them thread is parked
+#define IOT_SPIN_YIELDROUNDS 4
+//max time in microseconds of one parking of thread
+#define IOT_SPIN_PARKTIMEOUT 1000
+
+static inline void iot_cpu_relax(void) { //hints CPU that current thread is busy-waiting
+#if ECB_GCC_AMD64 || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || (defined(__ARM_ARCH) && __ARM_ARCH>=7)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+//Adaptive backoff for busy-waiting loops: rounds of exponentially growing number of pause instructions, then several sched_yield(), then parking
+//of thread on futex. Is created on stack for single wait, statistics of site is updated on destruction
+class iot_spin_backoff {
+	uint32_t round=0; //number of finished backoff rounds
+	uint32_t pauses=0, parks=0;
+	iot_spinsite_t site;
+
+public:
+	iot_spin_backoff(iot_spinsite_t site) : site(site) {
+		assert(site<IOT_SPINSITE_NUM);
+	}
+	~iot_spin_backoff(void) {
+		if(!round) return;
+		iot_spinsite_stats_t &st=iot_spinstats[site];
+		st.contended.fetch_add(1, std::memory_order_relaxed);
+		st.pauses.fetch_add(pauses, std::memory_order_relaxed);
+		if(round>IOT_SPIN_PAUSEROUNDS) st.yields.fetch_add(round-IOT_SPIN_PAUSEROUNDS-parks, std::memory_order_relaxed);
+		if(parks) st.parks.fetch_add(parks, std::memory_order_relaxed);
+	}
+	bool can_spin(void) const { //false when spinning rounds are exhausted and thread should be parked
+		return round<IOT_SPIN_PAUSEROUNDS+IOT_SPIN_YIELDROUNDS;
+	}
+	void spin(void) { //executes one round of spinning
+		if(round<IOT_SPIN_PAUSEROUNDS) {
+			uint32_t n=1u<<round;
+			for(uint32_t i=0;i<n;i++) iot_cpu_relax();
+			pauses+=n;
+		} else sched_yield();
+		round++;
+	}
+	void park(volatile std::atomic<uint32_t>* word, uint32_t expected) { //parks thread until value of word differs from expected and unpark() is
+																		//called for it, or until IOT_SPIN_PARKTIMEOUT. NULL word just parks thread
+																		//for timeout (for waits without notifying side)
+		round++;
+		parks++;
+		do_park(word, expected);
+	}
+	void wait(void) { //does next step of backoff for loops which have no notifying side
+		if(can_spin()) spin();
+			else park(NULL, 0);
+	}
+	static void unpark(volatile std::atomic<uint32_t>* word, uint32_t count=1); //wakes up to count threads parked on word
+
+private:
+	static void do_park(volatile std::atomic<uint32_t>* word, uint32_t expected);
+};
+
+//Lock for short critical sections. Contending threads spin with iot_spin_backoff and then park on futex. Unlocked state is all zero bits,
+//so zeroed memory can be used without construction
+class iot_spinlock {
+	volatile std::atomic<uint32_t> state; //0 - unlocked, 1 - locked, 2 - locked and there can be parked waiters
+
+public:
+	bool try_lock(void) {
+		uint32_t c=0;
+		return state.compare_exchange_strong(c, 1, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+	void lock(iot_spinsite_t site) {
+		if(try_lock()) return;
+		iot_spin_backoff backoff(site);
+		while(backoff.can_spin()) {
+			backoff.spin();
+			if(state.load(std::memory_order_relaxed)==0 && try_lock()) return;
+		}
+		while(state.exchange(2, std::memory_order_acquire)!=0) backoff.park(&state, 2);
+	}
+	void unlock(void) {
+		if(state.exchange(0, std::memory_order_release)==2) iot_spin_backoff::unpark(&state);
+	}
+};
+
 
 template<class Node, class NodeBase, volatile std::atomic<NodeBase*> NodeBase::* NextPtr> class mpsc_queue { //Multiple Producer (push, push_list) Single Consumer (pop, pop_all) unlimited FIFO queue. Deletions not possible
 	NodeBase *const stub;
@@ -67,14 +175,16 @@ public:
 	}
 
 	//adds several items connected by NextPtr field, with NULL for the last item
-	bool push_list(Node* listhead) { //returns true if first item is added (e.g. to send signal that queue is not empty)
-		Node* newtail=listhead;
+	bool push_list(Node* listhead, Node* listtail=NULL) { //returns true if first item is added (e.g. to send signal that queue is not empty)
+		//listtail can be provided if last item of list is known
+		Node* newtail=listtail ? listtail : listhead;
 		//find last item of supplied list
-		do {
+		if(!listtail) do {
 			Node* next=(newtail->*NextPtr).load(std::memory_order_relaxed);
 			if(!next) break;
 			newtail=next;
 		} while(1);
+		assert((newtail->*NextPtr).load(std::memory_order_relaxed)==NULL);
 		NodeBase* prevtail=tail.exchange(newtail, std::memory_order_acq_rel);
 		//(critial point)
 		(prevtail->*NextPtr).store(listhead, std::memory_order_release);
@@ -98,11 +208,8 @@ public:
 										/*  head will be modified if FALSE!!! */
 				head=stub;
 			} else { //push is right in progress. it can be at critial point so we must wait when it will be passed and 'next' gets non-NULL value
-				unsigned char c=0;
-				while(!(oldhead->*NextPtr).load(std::memory_order_acquire)) {
-					c++;
-					if((c & 0x3F) == 0x3F) sched_yield();
-				}
+				iot_spin_backoff backoff(IOT_SPINSITE_MPSC_POP);
+				while(!(oldhead->*NextPtr).load(std::memory_order_acquire)) backoff.wait();
 				head=(oldhead->*NextPtr).load(std::memory_order_relaxed); //non-NULL next becomes new head
 			}
 		}
@@ -131,11 +238,8 @@ public:
 				break;
 			}
 			//push is right in progress. it can be at critial point so we must wait when it will be passed and 'next' gets non-NULL value
-			unsigned char c=0;
-			while(!(head->*NextPtr).load(std::memory_order_acquire)) {
-				c++;
-				if((c & 0x3F) == 0x3F) sched_yield();
-			}
+			iot_spin_backoff backoff(IOT_SPINSITE_MPSC_POPALL);
+			while(!(head->*NextPtr).load(std::memory_order_acquire)) backoff.wait();
 			//here push was finished so we can continue to grab connected items (more than one could become ready at this point)
 			next=(head->*NextPtr).load(std::memory_order_relaxed);
 		} while(1);
@@ -266,5 +370,50 @@ public:
 };
 
 
+//number of bits of linear sub-buckets in every power of two range of iot_latency_histogram
+#define IOT_LATHIST_SUBBITS 2
+
+//Log-linear (HDR-like) histogram of 32-bit values (like durations in microseconds). Every power of two range is split into 2^IOT_LATHIST_SUBBITS
+//linear sub-buckets, so values are estimated with relative error below 1/2^IOT_LATHIST_SUBBITS. Must be updated by single thread, other threads
+//get approximate results
+struct iot_latency_histogram {
+	static constexpr unsigned subbuckets=1u<<IOT_LATHIST_SUBBITS;
+	static constexpr unsigned numbuckets=(32-IOT_LATHIST_SUBBITS+1)*subbuckets;
+
+	uint32_t counts[numbuckets];
+	uint64_t total, sum; //number of recorded values and their sum
+	uint32_t maxval;
+
+	static unsigned bucket_index(uint32_t v) {
+		if(v<subbuckets) return v;
+		unsigned shift=unsigned(ecb_ld32(v))-IOT_LATHIST_SUBBITS;
+		return (shift+1)*subbuckets + ((v>>shift) & (subbuckets-1));
+	}
+	static uint32_t bucket_maxval(unsigned idx) { //returns largest value which gets to bucket with provided index
+		if(idx<subbuckets) return idx;
+		unsigned shift=idx/subbuckets-1;
+		return uint32_t((uint64_t(subbuckets+idx%subbuckets+1)<<shift)-1);
+	}
+	void clear(void) {
+		memset(this, 0, sizeof(*this));
+	}
+	void record(uint32_t v) {
+		counts[bucket_index(v)]++;
+		total++;
+		sum+=v;
+		if(v>maxval) maxval=v;
+	}
+	uint32_t percentile(double p) const { //returns upper estimation of value below which 'p' percents of recorded values are
+		if(!total) return 0;
+		uint64_t need=uint64_t(double(total)*p/100.0+0.5), cnt=0;
+		if(!need) need=1;
+		for(unsigned i=0;i<numbuckets;i++) {
+			cnt+=counts[i];
+			if(cnt>=need) return bucket_maxval(i)<maxval ? bucket_maxval(i) : maxval;
+		}
+		return maxval;
+	}
+};
+
 
 #endif //IOT_COMMON_H
@@ -39,16 +39,17 @@ struct iot_modelsignal : public iot_releasable { //represents signal from specif
 //	bool is_sync=false; //if true, then reason_event is current event being executed (if hasn't timedout)
 //				//if false then says that event is NOT response to sync execution of reason_event (reason_event then can be some old event which became the reason).
 
-	iot_modelsignal(iot_nodemodel *model, const char* out_labeln, uint64_t reltime, const iot_datatype_base* msgval=NULL, /*bool is_sync=false,*/ const iot_event_id_t* reason=NULL);
+	iot_modelsignal(iot_nodemodel *model, const char* out_labeln, uint64_t reltime, const iot_datatype_base* msgval=NULL, /*bool is_sync=false,*/ const iot_event_id_t* reason=NULL) {
+		init(model, out_labeln, reltime, msgval, reason);
+	}
 	iot_modelsignal(void) : reason_event {}, node_id(0), module_id(0) {
 		out_label[0]='\0';
 	}
-	static void release(iot_modelsignal* &sig) {
-		assert(sig);
-		sig->iot_modelsignal::releasedata();
-		iot_release_memblock(sig);
-		sig=NULL;
-	}
+	void init(iot_nodemodel *model, const char* out_labeln, uint64_t reltime, const iot_datatype_base* msgval=NULL, /*bool is_sync=false,*/ const iot_event_id_t* reason=NULL);
+		//fills already constructed signal (with released data)
+
+	static iot_modelsignal* acquire(iot_memallocator* allocator); //returns constructed signal from pool of current thread or allocates new one as memblock. NULL on no memory
+	static void release(iot_modelsignal* &sig);
 	void clean(void) { //prepare struct for reuse by zeroing all fields. NOTE! if next is not NULL, all connected signals will be released!!!
 		iot_modelsignal::releasedata();
 		reltime=0;
@@ -60,18 +61,35 @@ struct iot_modelsignal : public iot_releasable { //represents signal from specif
 //		is_sync=false;
 	}
 	virtual void releasedata(void) override { //if ->next is not NULL then ASSUMES every connected item was allocated as memblock and releases it
-		if(next) {
-			next->releasedata();
-			iot_release_memblock(next);
-			next=NULL;
-		}
+		if(next) release(next); //nullifies next
 		if(data) {
 			data->release();
 			data=NULL;
 		}
 	}
+	virtual bool recycle(void) override;
 };
 
+//per-thread cache of constructed signals
+typedef iot_objpool<iot_modelsignal, 64, IOT_OBJPOOL_MODELSIGNAL> iot_modelsignal_pool;
+
+inline iot_modelsignal* iot_modelsignal::acquire(iot_memallocator* allocator) {
+	iot_modelsignal* sig=iot_modelsignal_pool::get(allocator);
+	if(sig) return sig;
+	sig=(iot_modelsignal*)allocator->allocate(sizeof(iot_modelsignal));
+	if(!sig) return NULL;
+	return new(sig) iot_modelsignal();
+}
+inline void iot_modelsignal::release(iot_modelsignal* &sig) {
+	assert(sig);
+	sig->iot_modelsignal::releasedata();
+	if(!iot_modelsignal_pool::put(sig)) iot_release_memblock(sig);
+	sig=NULL;
+}
+inline bool iot_modelsignal::recycle(void) {
+	return iot_modelsignal_pool::put(this);
+}
+
 //represents notification for node instance about update of inputs due to event processing
 struct iot_notify_inputsupdate : public iot_releasable {
 	iot_event_id_t reason_event={};
@@ -85,6 +103,9 @@ struct iot_notify_inputsupdate : public iot_releasable {
 	iot_notify_inputsupdate(uint16_t numalloced) : numalloced(numalloced) {
 	}
 
+	static iot_notify_inputsupdate* acquire(uint16_t num, iot_memallocator* allocator); //returns object with space for at least num items from pool
+																						//of current thread or allocates new one as memblock. NULL on no memory
+
 
 	size_t get_size(void) const {
 		return sizeof(*this)+numalloced*sizeof(item[0]);
@@ -105,8 +126,28 @@ struct iot_notify_inputsupdate : public iot_releasable {
 			}
 		numitems=0;
 	}
+	virtual bool recycle(void) override;
 };
 
+//per-thread cache of constructed input update notifications
+typedef iot_objpool<iot_notify_inputsupdate, 16, IOT_OBJPOOL_INPUTSUPDATE> iot_notify_inputsupdate_pool;
+
+inline iot_notify_inputsupdate* iot_notify_inputsupdate::acquire(uint16_t num, iot_memallocator* allocator) {
+	iot_notify_inputsupdate* obj=iot_notify_inputsupdate_pool::get(allocator);
+	if(obj) {
+		if(obj->numalloced>=num) return obj;
+		iot_release_memblock(obj); //too small
+	}
+	if(num<=0xFFF8) num=(num+7) & ~7; //round capacity to improve reuse
+	size_t sz=calc_size(num);
+	void* mem=allocator->allocate(uint32_t(sz), true);
+	if(!mem) return NULL;
+	return new(mem) iot_notify_inputsupdate(num);
+}
+inline bool iot_notify_inputsupdate::recycle(void) {
+	return iot_notify_inputsupdate_pool::put(this);
+}
+
 
 //models node with several inputs and several outputs. each input/output is iot_nodelinkmodel object, which is instanciated by some node output
 struct iot_nodemodel {
@@ -192,6 +233,9 @@ struct iot_nodemodel {
 		}
 	} syncexec; // state of sync execution. modified from instance thread!!!
 
+	iot_modelsignal* deferred_signals; //output signals of async node kept in instance thread while main thread is congested (see msgq_watermark). value
+										//signals for same output are coalesced. modified from instance thread!!!
+
 	bool links_valid; //flag that all links in curvalueinput, curvalueoutput, curmsginput and curmsgoutput are valid (successfully allocated if necessary)
 
 	uint8_t is_sync; //0 - async (no is_sync flag in node iface config), 1 - sync (there is is_sync flag but simple mode impossible or was reset),
@@ -213,8 +257,10 @@ public:
 	bool do_execute(bool isasync, iot_threadmsg_t *&msg, iot_modelsignal *&outsignals); //instance thread
 	int do_update_outputs(const iot_event_id_t *reason_eventid, uint8_t num_values, const uint8_t *valueout_indexes, const iot_valuetype_BASE** values, uint8_t num_msgs, const uint8_t *msgout_indexes, const iot_msgtype_BASE** msgs);
 	const iot_valuetype_BASE* get_outputvalue(uint8_t index);
+	void flush_deferred_outputs(void); //instance thread. sends deferred_signals to main thread if it is not congested
 
 private:
+	void defer_outputs(iot_modelsignal* outsignals); //instance thread. adds list of signals to deferred_signals replacing older values of same outputs
 	void try_create_instance(void); //called to recreate node module instance
 };
 
@@ -85,7 +85,7 @@ struct iot_device_connection_t {
 							   //value of client_host or driver_host show)
 	} state;
 	
-	std::atomic_flag acclock; //lock to protect connection structure when it can be accessed/modified during processing connect in non-main threads.
+	iot_spinlock acclock; //lock to protect connection structure when it can be accessed/modified during processing connect in non-main threads.
 							//this lock MUST be obtained by main thread before destroying connection which has state>=IOT_DEVCONN_PENDING as there can be 
 							//messages in driver's or consumer's queue to work with same connection. Those async operations MUST use locking too.
 							//Other threads must check connkey first and treat old connnection as closed on non-match without prior locking acclock. After
@@ -136,15 +136,10 @@ public:
 	int close(iot_threadmsg_t* asyncmsg=NULL); //any thread
 
 	void lock(void) { //tries to lock structure from modifying
-		uint8_t c=0;
-		while(acclock.test_and_set(std::memory_order_acquire)) {
-			//busy wait
-			c++;
-			if((c & 0x3F)==0x3F) sched_yield();
-		}
+		acclock.lock(IOT_SPINSITE_DEVCONN_LOCK);
 	}
 	void unlock(void) {
-		acclock.clear(std::memory_order_release);
+		acclock.unlock();
 	}
 
 	int connect_remote(iot_miid_t& driver_inst);//, const iot_devifacetype_id_t* ifaceclassids, uint8_t num_ifaceclassids);
@@ -200,6 +195,7 @@ public:
 
 
 private:
+	friend struct iot_thread_item_t; //retries d2c_ready() and c2d_ready() deferred because of congested thread
 
 	void d2c_ready(void); //called by driver after writing data to d2c stream buffer
 //	void c2d_write_ready(void); //called by driver after reading data from c2d stream buffer if c2d.want_write is true
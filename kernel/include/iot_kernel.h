@@ -39,6 +39,10 @@ enum iot_msg_code_t : uint16_t {
 
 	IOT_MSG_THREAD_SHUTDOWN,		//process shutdown of thread (break event loop and exit thread)
 	IOT_MSG_THREAD_SHUTDOWNREADY,	//notification to main thread about child thread stop. [data] contains thread item address
+	IOT_MSG_THREAD_MEMREPORT,		//request to thread to log memory blocks in use by its allocator
+	IOT_MSG_MIGRATE_MODINSTANCE,	//request to current thread of instance in [miid] to hand it over to another thread. [data] contains target thread item address
+	IOT_MSG_MODINSTANCE_MIGRATED,	//notification to main thread about result of migration of instance in [miid] (status will be in intarg). [data] contains target thread item address
+	IOT_MSG_BACKPRESSURE_RETRY,		//producer action of instance in [miid] deferred by its previous thread because of congestion. [data] contains iot_thread_item_t::bpretry_t
 
 	IOT_MSG_EVENTSIG_OUT,			//notification to config modeller about change of output value or new output msg. [data] contains iot_modelsignal pointer.
 	IOT_MSG_EVENTSIG_NOUPDATE,		//notification to config modeller that sync execution of node changed NO outputs. [data] contains iot_modelnegsignal pointer.
@@ -46,7 +50,37 @@ enum iot_msg_code_t : uint16_t {
 //node instance destined messages
 	IOT_MSG_NOTIFY_INPUTSUPDATED,	//notification to modinstance about change of input value(s) and/or new input msg(s). [data] contains iot_notify_inputsupdate
 									//pointer. [bytearg] contains sync mode at the time of message generation in main thread
+
+	IOT_MSG_NUMCODES				//number of message codes. must be last
 };
+const char* iot_msg_code_name(iot_msg_code_t code); //returns name of message code for logging
+
+//priority lanes of thread message queue. lower value means higher priority
+enum iot_threadmsg_lane_t : uint8_t {
+	IOT_THREADMSG_LANE_CONTROL=0,	//thread and instance lifecycle, connection setup and close
+	IOT_THREADMSG_LANE_DATA,		//high-volume data notifications
+
+	IOT_THREADMSG_NUMLANES
+};
+
+//max number of messages of corresponding lane processed during one event loop iteration
+#define IOT_THREADMSG_QUANTUM_CONTROL 64
+#define IOT_THREADMSG_QUANTUM_DATA 256
+
+inline iot_threadmsg_lane_t iot_msg_lane(iot_msg_code_t code) { //selects queue lane for message code
+	switch(code) {
+		case IOT_MSG_CONNECTION_D2C_READY:
+		case IOT_MSG_CONNECTION_C2D_READY:
+		case IOT_MSG_EVENTSIG_OUT:
+		case IOT_MSG_EVENTSIG_NOUPDATE:
+		case IOT_MSG_NOTIFY_INPUTSUPDATED:
+		case IOT_MSG_BACKPRESSURE_RETRY:
+		case IOT_MSG_MIGRATE_MODINSTANCE: //data notifications queued before hand-over must be processed by old thread
+			return IOT_THREADMSG_LANE_DATA;
+		default:
+			return IOT_THREADMSG_LANE_CONTROL;
+	}
+}
 
 extern iot_thread_item_t* main_thread_item; //prealloc main thread item
 extern iot_thread_registry_t* thread_registry;
@@ -54,15 +88,61 @@ extern iot_thread_registry_t* thread_registry;
 extern uv_loop_t *main_loop;
 extern volatile sig_atomic_t need_exit;
 extern int max_threads; //maximum threads to run (specified from command line). limited by IOT_THREADS_MAXNUM
+extern uint32_t memtrim_interval; //period in seconds of trimming freelists of memory allocators in every thread. zero (default) disables trimming
+extern uint32_t msgstats_interval; //period in seconds of dumping message latency statistics. zero disables collection of statistics
+extern uint32_t msgq_watermark; //number of messages in data lane of thread queue after which producers must defer or coalesce new data messages. zero (default) disables
+extern uint32_t rebalance_interval; //minimal period in seconds between migrations of module instances from most loaded thread. zero disables rebalancing
+extern uint32_t cpuacct_interval; //period in seconds of updating CPU load estimations of module instances from measured CPU time. zero (default) disables
+								//measurement. when enabled, thread CPU clock is read by syscall after every message handler. time spent in libuv callbacks of
+								//instances (timers, I/O) is not measured per instance, it is shared between instances of thread proportionally to declared cpu_loading
+extern uint32_t thread_idle_timeout; //period in seconds after which worker thread without module instances is stopped. zero (default) disables stopping of idle threads
+extern uint32_t workpool_size; //number of threads in pool for blocking jobs of module instances (see kapi_run_blocking()). zero means libuv default
+
+//CPU placement of threads. CPU sets are kept as bit masks, so only CPUs with numbers below IOT_THREAD_MAXCPUS can be used
+#define IOT_THREAD_MAXCPUS 64
+#define IOT_THREAD_MAXCPUSETS 16
+struct iot_threadsetup_t {
+	uint64_t main_cpus=0; //CPUs for main thread. zero means no pinning
+	uint64_t worker_cpus[IOT_THREAD_MAXCPUSETS]={}; //CPU sets for worker threads. worker with thread_id N gets set (N-1)%num_worker_cpus
+	uint8_t num_worker_cpus=0; //zero means no pinning of workers
+	uint8_t rt_priority=0; //SCHED_FIFO priority of worker threads which host latency-critical instances. zero disables such threads
+	uint64_t rt_cpus=0; //CPUs for real-time worker threads. zero means that worker_cpus are used
+};
+extern iot_threadsetup_t thread_setup;
+
+int iot_parse_cpulist(const char* str, uint64_t &mask); //parses list of CPUs like "0,2-3" into mask. returns 0 on success or IOT_ERROR_INVALID_ARGS
 
 //void kern_notifydriver_removedhwdev(iot_hwdevregistry_item_t*);
 
 #define IOT_THREAD_LOADING_MAX 1000
 #define IOT_THREAD_LOADING_MAIN (IOT_THREAD_LOADING_MAX/10)
+//smoothing factor of measured CPU load: every cpuacct_interval estimation moves by 1/IOT_CPUACCT_DECAY of difference with last measurement
+#define IOT_CPUACCT_DECAY 4
+//minimal difference between estimated loading of most and least loaded threads to start migration of instance
+#define IOT_REBALANCE_THRESHOLD (IOT_THREAD_LOADING_MAX/5)
+//minimal time in seconds instance must stay in its thread before it can be migrated
+#define IOT_REBALANCE_MINAGE 60
+//minimal period in seconds between restarts of non-migratable driver instances made by rebalancing to move them to less loaded thread
+#define IOT_REBALANCE_RESTARTPERIOD 600
+//max estimated loading of thread after absorbing all instances of lightly loaded thread which is then stopped
+#define IOT_THREAD_ABSORB_LOAD (IOT_THREAD_LOADING_MAX/2)
+
+//upper limit for workpool_size (limit of libuv thread pool)
+#define IOT_WORKPOOL_MAXSIZE 128
+//max number of blocking jobs of one module instance which can be pending simultaneously
+#define IOT_WORKPOOL_MAXJOBS 64
+
+//length in milliseconds of tick of per-thread timing wheel
+#define IOT_THREAD_TIMERTICK 10
 
 //upper limit on threads number for max_threads
 #define IOT_THREADS_MAXNUM 100
 
+//max number of producer actions deferred by one thread because of congested destination threads
+#define IOT_BACKPRESSURE_MAXRETRIES 32
+//delay in milliseconds before retrying deferred producer actions
+#define IOT_BACKPRESSURE_RETRY_DELAY 5
+
 //selects memory model for message data argument to extended version of iot_thread_item_t::send_msg
 enum iot_threadmsg_datamem_t : uint8_t {
 	IOT_THREADMSG_DATAMEM_STATIC, //provided data buffer points to static buffer (or datasize is zero and data is arbitraty integer), so no releasing required
@@ -78,6 +158,9 @@ enum iot_threadmsg_datamem_t : uint8_t {
 
 struct iot_releasable {
 	virtual void releasedata(void) = 0; //called to free/release dynamic data connected with object
+	virtual bool recycle(void) { //called after releasedata() for object allocated as memblock. returns true if object was taken for reuse and must not be released
+		return false;
+	}
 };
 
 struct iot_threadmsg_t { //this struct MUST BE 64 bytes
@@ -100,8 +183,9 @@ struct iot_threadmsg_t { //this struct MUST BE 64 bytes
 					//'data' is used to store arbitraty integer.
 	void* data; //data corresponding to code. can point to builtin buffer if IOT_MSG_BUFSIZE is enough or be allocated as memblock (is_memblock==1) or
 				//malloc (is_malloc==1). Can be used to store arbitrary integer value (up to 32 bit for compatibility) when both is_memblock and is_malloc are 0.
+	uint32_t enqueue_time; //lower 32 bits of time in microseconds when message was sent. set only when message statistics is collected
 
-	char buf[64-(sizeof(std::atomic<iot_threadmsg_t*>)+sizeof(void*)+sizeof(iot_miid_t)+sizeof(iot_msg_code_t)+2+4+sizeof(int))]; //must complement struct to 64 bytes!
+	char buf[64-(sizeof(std::atomic<iot_threadmsg_t*>)+sizeof(void*)+sizeof(iot_miid_t)+sizeof(iot_msg_code_t)+2+4+4+sizeof(int))]; //must complement struct to 64 bytes!
 	int intarg; //arbitrary int argument for command in code when datasize is 0 or <= IOT_MSG_INTARG_SAFEDATASIZE.
 
 	bool is_free(void) volatile { //for use with static msg structs to determine is struct is not in use just now
@@ -114,6 +198,7 @@ struct iot_threadmsg_t { //this struct MUST BE 64 bytes
 		return next.load(std::memory_order_relaxed);
 	}
 };
+static_assert(sizeof(iot_threadmsg_t)==64, "iot_threadmsg_t must be 64 bytes");
 #define IOT_MSG_BUFSIZE (sizeof(iot_threadmsg_t)-offsetof(struct iot_threadmsg_t, buf))
 #define IOT_MSG_INTARG_SAFEDATASIZE (offsetof(struct iot_threadmsg_t, intarg) - offsetof(struct iot_threadmsg_t, buf))
 
@@ -121,6 +206,9 @@ struct iot_threadmsg_t { //this struct MUST BE 64 bytes
 
 #include "iot_memalloc.h"
 
+//per-thread cache of message structs allocated by iot_memallocator::allocate_threadmsg() and released by iot_release_msg()
+typedef iot_objpool<iot_threadmsg_t, 64, IOT_OBJPOOL_THREADMSG> iot_threadmsg_pool;
+
 //fills thread message struct
 //'msg' arg can be NULL to request struct allocation from provided allocator (which can be NULL to request its auto selection).
 //Otherwise (if struct is already allocated) it must be zeroed and 'is_msgmemblock' set correctly.
@@ -144,6 +232,43 @@ void iot_release_msg(iot_threadmsg_t *&msg, bool = false);
 //#include "iot_deviceregistry.h"
 #include "iot_moduleregistry.h"
 
+//max number of different destination threads in one message batch (additional threads plus main one)
+#define IOT_THREADMSG_BATCH_MAXTHREADS (IOT_THREADS_MAXNUM+1)
+
+//Collects messages sent by iot_thread_item_t::send_msg() in current thread while object exists. On destruction (or explicit flush()) messages for
+//every destination thread are delivered by single push_list() with at most one wakeup of destination. Must be created on stack around code which
+//sends many messages (fan-out to instances). Nested batches are merged into outermost one
+class iot_threadmsg_batch {
+	struct entry_t {
+		iot_thread_item_t* thread;
+		iot_threadmsg_lane_t lane;
+		iot_threadmsg_t *head, *tail;
+		uint32_t count;
+	} entries[IOT_THREADMSG_BATCH_MAXTHREADS*IOT_THREADMSG_NUMLANES];
+	unsigned numentries=0;
+	static thread_local iot_threadmsg_batch* current; //outermost active batch of current thread. nested batches are never active and do nothing
+
+	void do_add(iot_thread_item_t* thread, iot_threadmsg_t* msg);
+public:
+	iot_threadmsg_batch(void) {
+		if(!current) current=this; //otherwise batch is nested
+	}
+	~iot_threadmsg_batch(void) {
+		if(current!=this) return;
+		current=NULL; //cleared before delivery, so pointer to this object never outlives it
+		flush();
+	}
+	static bool add(iot_thread_item_t* thread, iot_threadmsg_t* msg) { //returns false if there is no active batch in current thread
+		if(!current) return false;
+		current->do_add(thread, msg);
+		return true;
+	}
+	void flush(void); //delivers collected messages
+	static void flush_current(void) { //delivers messages collected by active batch of current thread (if any)
+		if(current) current->flush();
+	}
+};
+
 struct iot_thread_item_t {
 	iot_threadmsg_t termmsg={}; //preallocated msg structire to send
 	iot_thread_item_t *next=NULL, *prev=NULL; //position in iot_thread_registry_t::threads_head list
@@ -152,54 +277,134 @@ struct iot_thread_item_t {
 	uv_loop_t* loop=NULL;
 	iot_memallocator* allocator=NULL;
 	uv_async_t msgq_watcher; //gets signal when new message arrives
+	uv_timer_t memtrim_watcher; //periodically returns excess free memory of allocator to OS
+	uv_check_t remotefree_watcher; //returns memory blocks released by this thread to allocators of other threads after each loop iteration
+	uv_timer_t bpretry_watcher; //retries producer actions deferred because of congested destination thread
 	iot_modinstance_item_t *instances_head=NULL; //list of instances, which work (or will work after start) in this thread
 	iot_modinstance_item_t *hung_instances_head=NULL; //list of instances in HUNG state
 
-	mpsc_queue<iot_threadmsg_t, iot_threadmsg_t, &iot_threadmsg_t::next> msgq;
-	uint16_t cpu_loading=0; //current sum of declared cpu loading
-	bool is_shutdown=false;
-
-
-	struct {
-		iot_atimer timer;
-		uint32_t interval;
-	} atimer_pool[8]={};
+	mpsc_queue<iot_threadmsg_t, iot_threadmsg_t, &iot_threadmsg_t::next> msgq[IOT_THREADMSG_NUMLANES]; //message queue for every priority lane
+	volatile std::atomic<uint32_t> msgq_depth[IOT_THREADMSG_NUMLANES]={}; //number of messages sent to every lane and not popped yet
+	volatile std::atomic<uint64_t> backpressure_count={0}; //how many times producers deferred or coalesced messages to this thread because of crossed msgq_watermark
+	struct bpretry_t { //producer action deferred by this thread because destination thread was congested
+		enum : uint8_t {
+			RETRY_C2D_READY, //call c2d_ready() for connection with 'connident'
+			RETRY_D2C_READY, //call d2c_ready() for connection with 'connident'
+			RETRY_NODE_OUTPUTS //send outputs of node instance 'miid' accumulated by iot_nodemodel
+		} type;
+		iot_connid_t connident;
+		iot_miid_t miid;
+	} bpretry[IOT_BACKPRESSURE_MAXRETRIES]; //accessed by thread of this item only
+	uint32_t num_bpretries=0;
+	struct msgstats_t { //latency statistics for every message code. updated by thread of this item only
+		iot_latency_histogram wait, handler; //time in microseconds between sending and start of processing, time of processing
+	} *msgstats=NULL; //array with IOT_MSG_NUMCODES items. allocated when msgstats_interval is non-zero
+	struct jobstats_t { //latency statistics of blocking jobs of instances of this thread. updated by thread of this item only
+		iot_latency_histogram wait, run; //time in microseconds between queuing and start of job in pool, time of job execution
+	} *jobstats=NULL; //allocated when msgstats_interval is non-zero
+	uint16_t cpu_loading=0; //current sum of cpu_load of instances (plus IOT_THREAD_LOADING_MAIN for main thread)
+	uint64_t cpu_time_seen=0; //thread CPU time in nanoseconds at previous update_cpu_loads(). main thread only
+	uint16_t migrations_in=0; //number of instances being migrated into this thread. main thread only
+	bool is_realtime=false; //thread runs with SCHED_FIFO priority and hosts latency-critical instances only
+	bool is_draining=false; //all instances are being migrated to other threads, so thread is not used for new instances and stopped when empty. main thread only
+	uint64_t idle_since=0; //uv_now(main_loop) when thread was first seen without instances, zero if it has instances. main thread only
+	bool is_reclaimed=false; //thread was stopped by reclaim_threads(), so messages sent to it after shutdown are rerouted to main thread. set before is_shutdown.
+							//item of such thread is never freed while registry works, as producers can hold pointer to it for any time, but is reused by restart()
+	volatile std::atomic<bool> is_shutdown={false}; //thread was requested to exit and does not accept new messages. checked by producers from any thread
+
+	iot_timerwheel timerwheel; //timers of kernel jobs of thread (like rechecks of module instances)
+
+	static thread_local iot_thread_item_t* current; //item of current thread or NULL if thread is not managed by registry
+	static thread_local iot_memallocator* current_allocator; //allocator of current thread (copy of current->allocator)
+	static thread_local uv_loop_t* current_loop; //event loop of current thread (copy of current->loop)
 
 	iot_thread_item_t(void) {
 		thread_id=last_thread_id++;
 	}
 
 	int init(bool ismain=false);
+	int restart(bool realtime); //starts new thread for item of thread stopped by reclaim_threads(), keeping its loop, queue and allocator
 
 	void deinit(void);
 
-	void send_msg(iot_threadmsg_t* msg) {
-		if(is_shutdown) return;
+	void start_memtrim(void); //starts periodic trimming of allocator. must be called in thread of this item
+	void set_cpu_placement(void); //applies CPU affinity and scheduling policy from thread_setup. must be called in thread of this item
+
+	void send_msg(iot_threadmsg_t* msg) { //message is delivered immediately or by iot_threadmsg_batch if it is active in current thread
+		if(is_shutdown.load(std::memory_order_acquire)) {
+			if(is_reclaimed) main_thread_item->send_msg(msg); //main thread forwards message to current thread of its instance
+			return;
+		}
 		assert(msg->code!=0 && loop!=NULL);
-		if(msgq.push(msg)) {
+		if(msgstats_interval) msg->enqueue_time=uint32_t(uv_hrtime()/1000);
+		if(iot_threadmsg_batch::add(this, msg)) return;
+		iot_threadmsg_lane_t lane=iot_msg_lane(msg->code);
+		msgq_depth[lane].fetch_add(1, std::memory_order_relaxed); //incremented before push so that consumer never sees negative depth
+		if(msgq[lane].push(msg)) {
 			uv_async_send(&msgq_watcher);
 		}
 	}
-	void schedule_atimer(iot_atimer_item& it, uint64_t delay) { //schedules atimer_item to signal after delay or earlier
-		assert(uv_thread_self()==main_thread);
-		for(int i=sizeof(atimer_pool)/sizeof(atimer_pool[0])-1;i>=1;i--) {
-			if(delay<atimer_pool[i].interval) continue;
-			atimer_pool[i].timer.schedule(it);
+	void send_msg_list(iot_threadmsg_lane_t lane, iot_threadmsg_t* head, iot_threadmsg_t* tail, uint32_t count) { //delivers list of 'count' messages linked
+																								//by 'next' field to specified lane. used by iot_threadmsg_batch
+		assert(head!=NULL && tail!=NULL && loop!=NULL && lane<IOT_THREADMSG_NUMLANES && count>0);
+		if(is_shutdown.load(std::memory_order_acquire)) {
+			if(is_reclaimed) main_thread_item->send_msg_list(lane, head, tail, count);
 			return;
 		}
-		atimer_pool[0].timer.schedule(it);
+		msgq_depth[lane].fetch_add(count, std::memory_order_relaxed);
+		if(msgq[lane].push_list(head, tail)) {
+			uv_async_send(&msgq_watcher);
+		}
+	}
+	iot_threadmsg_t* pop_msg(uint32_t (&quota)[IOT_THREADMSG_NUMLANES]) { //pops message from highest priority lane which is not empty and has non-zero
+																			//quota. quota of lane is decremented. returns NULL if no such message
+		for(unsigned lane=0;lane<IOT_THREADMSG_NUMLANES;lane++) {
+			if(!quota[lane]) continue;
+			iot_threadmsg_t* msg=msgq[lane].pop();
+			if(msg) {
+				msgq_depth[lane].fetch_sub(1, std::memory_order_relaxed);
+				quota[lane]--;
+				return msg;
+			}
+		}
+		return NULL;
+	}
+	bool is_congested(void) const { //checks if data lane of queue has reached msgq_watermark. can be called from any thread
+		return msgq_watermark>0 && msgq_depth[IOT_THREADMSG_LANE_DATA].load(std::memory_order_relaxed)>=msgq_watermark;
+	}
+	bool defer_to(iot_thread_item_t* dest, const bpretry_t &retry); //must be called in thread of this item by producer which found 'dest' congested.
+																	//remembers action to be retried later and updates counter of 'dest' on success. returns false
+																	//if action cannot be deferred (no free slot), so producer must send message anyway
+	void retry_deferred(const bpretry_t &retry); //runs deferred producer action in thread of this item. action of instance moved to another thread is forwarded there
+	void schedule_atimer(iot_atimer_item& it, uint64_t delay, uint64_t slack=0) { //schedules atimer_item to signal after delay (not later than slack plus
+																				//IOT_THREAD_TIMERTICK after it). must be called in thread of this item
+		timerwheel.schedule(it, delay, slack);
 	}
 private:
 	static uint32_t last_thread_id;
+	int start_thread(void); //creates OS thread running thread_func() with all signals blocked
 	void thread_func(void);
+	void set_current(bool clear=false) { //assigns (or clears) thread-local pointers of current thread to this item. must be called in thread of this item
+		current=clear ? NULL : this;
+		current_allocator=clear ? NULL : allocator;
+		current_loop=clear ? NULL : loop;
+	}
+	static void on_bpretry(uv_timer_t* w); //retries deferred producer actions
 };
 
+inline iot_memallocator* iot_current_allocator(void) {
+	return iot_thread_item_t::current_allocator;
+}
+
 
 class iot_thread_registry_t {
 	iot_thread_item_t *threads_head=NULL;
 	iot_thread_item_t *delthreads_head=NULL;
 	int num_threads=0; //number of started additional threads (not counting main)
 	iot_thread_item_t main_thread_obj;
+	uint64_t cpuacct_time=0; //uv_hrtime() at previous update_cpu_loads()
+	uint64_t rebalance_time=0; //uv_now() of previous instance migration or restart by rebalance()
+	uint64_t restart_time=0; //uv_now() of previous instance restart by rebalance()
 
 public:	
 	bool is_shutdown=false;
@@ -207,8 +412,18 @@ public:
 	iot_thread_registry_t(void);
 	void remove_modinstance(iot_modinstance_item_t* inst_item);
 	void add_modinstance(iot_modinstance_item_t* inst_item, iot_thread_item_t* thread_item);
-	iot_thread_item_t* assign_thread(uint8_t cpu_loadtp);
+	iot_thread_item_t* assign_thread(uint8_t cpu_loadtp, bool realtime=false); //realtime requests thread with SCHED_FIFO priority if enabled by thread_setup
+	void reclaim_threads(void); //stops worker threads which have no instances for thread_idle_timeout and drains lightly loaded thread into another one.
+								//called every thread_idle_timeout
+	void forward_stopped_msgs(void); //resends messages which were sent to threads stopped by reclaim_threads() after their exit to main thread
+	void free_stopped_threads(void); //frees items (and allocators when they have no blocks in use) of stopped threads. called when all other threads have exited
+	void rebalance(void); //moves one instance from overloaded working thread to least loaded if difference of their estimated loading is large. called by update_cpu_loads()
+	int migrate_modinstance(iot_modinstance_item_t* inst_item, iot_thread_item_t* thread_item); //starts live migration of migratable started instance to another thread
+	void on_modinstance_migrated(iot_modinstance_item_t* inst_item, iot_thread_item_t* thread_item, int err); //processes result of migration. inst_item is NULL if
+																										//instance was freed before migration
 	static void on_thread_msg(uv_async_t* handle);
+	static void process_thread_msgs(iot_thread_item_t* thread_item, bool bounded); //processes messages in queue of thread. true 'bounded' limits
+																					//number of messages processed from every lane
 
 	iot_thread_item_t* find_thread(uv_thread_t th_id) {
 		assert(uv_thread_self()==main_thread);
@@ -220,19 +435,32 @@ public:
 		}
 		return NULL;
 	}
-	iot_memallocator* find_allocator(uv_thread_t th_id) {
-		iot_thread_item_t* th=find_thread(th_id);
+	iot_memallocator* find_allocator(uv_thread_t th_id) { //allocator of current thread is returned from any thread without lookup. other threads can be
+														//found in main thread only
+		iot_thread_item_t* th=iot_thread_item_t::current;
+		if(th && th->thread==th_id) return iot_thread_item_t::current_allocator;
+		th=find_thread(th_id);
 		if(th) return th->allocator;
 		return NULL;
 	}
-	uv_loop_t* find_loop(uv_thread_t th_id) {
-		iot_thread_item_t* th=find_thread(th_id);
+	uv_loop_t* find_loop(uv_thread_t th_id) { //loop of current thread is returned from any thread without lookup. other threads can be found in main thread only
+		iot_thread_item_t* th=iot_thread_item_t::current;
+		if(th && th->thread==th_id) return iot_thread_item_t::current_loop;
+		th=find_thread(th_id);
 		if(th) return th->loop;
 		return NULL;
 	}
 
+	void update_cpu_loads(void); //recalculates cpu_load of all module instances and cpu_loading of threads from measured CPU time. called every cpuacct_interval
+	void dump_memstats(void); //outputs statistics of memory allocators of all threads to log
+	void dump_cpustats(void); //outputs CPU usage of threads and module instances to log
+	void dump_msgstats(void); //outputs message latency and spin contention statistics of all threads to log
+	void report_memblocks(void); //requests all threads to log memory blocks in use by their allocators
+
 	void graceful_shutdown(void); //initiate graceful shutdown, stop all module instances in all threads
 	void on_thread_modinstances_ended(iot_thread_item_t* thread); //called by remove_modinstance() after removing last modinstance in shutdown mode
+	void shutdown_thread(iot_thread_item_t* thread, bool reclaim=false); //requests non-main thread without instances to exit. on_thread_shutdown() is called
+																		//when it exits. 'reclaim' is true when thread is stopped while registry works
 	void on_thread_shutdown(iot_thread_item_t* thread);
 };
 
@@ -17,6 +17,7 @@
 struct iot_memobject;
 class iot_memallocator;
 extern iot_memallocator main_allocator;
+inline iot_memallocator* iot_current_allocator(void); //allocator of current thread or NULL if thread is not managed by thread registry. defined in iot_kernel.h
 
 #include "iot_common.h"
 
@@ -36,6 +37,10 @@ struct iot_memobject {
 #ifndef NDEBUG
 	void* backtrace[3];
 	timeval alloctimeval;
+	uint32_t allocsize; //requested size of block
+#if UINTPTR_MAX>UINT32_MAX
+	uint32_t _pad; //keeps 'data' aligned to pointer size on 64-bit targets
+#endif
 #endif
 	volatile std::atomic<uint32_t> refcount; //reference count of this object. object is returned to free list when its refcount goes to zero
 	uint16_t	memchunk; //index of parent memchunk in parent->memchunks array
@@ -43,22 +48,162 @@ struct iot_memobject {
 								//15 means that memory object is temporary and has arbitrary size
 	uint32_t data[1]; //arbitrary data or iot_membuf_chain if listindex==14. ensure alignment by 4 using uint32_t
 };
+static_assert(offsetof(iot_memobject, data)%sizeof(void*)==0, "data of iot_memobject must be aligned to pointer size");
 
 #define IOT_MEMOBJECT_SIGNATURE ('M'*65536*256+'e'*65536+'m'*256+'O')
 
+//Size classes of plain freelists 0-12 (full block size including iot_memobject header). Freelist 13 is always for blocks of maximum plain size,
+//freelist 14 is for blocks of chained buffers. Can be overridden at build time by list of 13 ascending multiples of IOT_MEMALLOC_SIZEGRANULE
+#ifndef IOT_MEMALLOC_SIZECLASSES
+#define IOT_MEMALLOC_SIZECLASSES 32, 48, 64, 80, 96, 128, 160, 256, 384, 512, 1024, 2048, 4096
+#endif
+
+//granularity of size class lookup table
+#define IOT_MEMALLOC_SIZEGRANULE 16
+
+constexpr uint32_t iot_memalloc_optblock(uint32_t objsize) { //optimal size of OS-allocated chunk for blocks of specified size
+	return objsize<=64 ? 16384 : objsize<=256 ? 32768 : objsize<=1024 ? 65536 : objsize<=2048 ? 128*1024 : 256*1024;
+}
+
+template<unsigned... I> struct iot_index_seq {};
+template<unsigned N, unsigned... I> struct iot_make_index_seq : iot_make_index_seq<N-1, N-1, I...> {};
+template<unsigned... I> struct iot_make_index_seq<0, I...> {
+	typedef iot_index_seq<I...> type;
+};
+
+//Set of freelist size classes. 'lookup' maps size rounded up to IOT_MEMALLOC_SIZEGRANULE to freelist index, so allocate() needs no comparisons
+template<uint32_t... Sizes> struct iot_memalloc_sizeclasses {
+	static constexpr unsigned numplain=sizeof...(Sizes)+1; //number of freelists for plain blocks
+	static constexpr uint32_t maxsize=IOT_MEMOBJECT_MAXPLAINSIZE+offsetof(struct iot_memobject, data); //size of blocks in last plain freelist
+	static constexpr uint32_t objsizes[numplain+1]={Sizes..., maxsize, IOT_MEMOBJECT_CHAINSIZE}; //size of objects for corresponding freelist
+	static constexpr uint32_t objoptblock[numplain+1]={iot_memalloc_optblock(Sizes)..., iot_memalloc_optblock(maxsize), iot_memalloc_optblock(IOT_MEMOBJECT_CHAINSIZE)};
+
+	static constexpr unsigned find(uint32_t size, unsigned idx=0) { //finds index of freelist for specified size
+		return idx+1>=numplain || size<=objsizes[idx] ? idx : find(size, idx+1);
+	}
+	static constexpr bool is_valid(unsigned idx=0) { //checks that sizes are ascending and aligned to granule
+		return idx+1>=numplain || (objsizes[idx] % IOT_MEMALLOC_SIZEGRANULE==0 && objsizes[idx]<objsizes[idx+1] && is_valid(idx+1));
+	}
+
+	template<class Seq> struct table;
+	template<unsigned... I> struct table<iot_index_seq<I...>> {
+		static constexpr uint8_t lookup[sizeof...(I)]={uint8_t(find(I*IOT_MEMALLOC_SIZEGRANULE))...};
+	};
+	typedef table<typename iot_make_index_seq<(maxsize+IOT_MEMALLOC_SIZEGRANULE-1)/IOT_MEMALLOC_SIZEGRANULE+1>::type> table_t;
+
+	static unsigned listindex(uint32_t size) { //'size' must include header and be not greater than maxsize
+		assert(size<=maxsize);
+		return table_t::lookup[(size+IOT_MEMALLOC_SIZEGRANULE-1)/IOT_MEMALLOC_SIZEGRANULE];
+	}
+};
+template<uint32_t... Sizes> constexpr uint32_t iot_memalloc_sizeclasses<Sizes...>::objsizes[];
+template<uint32_t... Sizes> constexpr uint32_t iot_memalloc_sizeclasses<Sizes...>::objoptblock[];
+template<uint32_t... Sizes> template<unsigned... I> constexpr uint8_t iot_memalloc_sizeclasses<Sizes...>::table<iot_index_seq<I...>>::lookup[];
+
+typedef iot_memalloc_sizeclasses<IOT_MEMALLOC_SIZECLASSES> iot_memalloc_sizeclasses_t;
+static_assert(iot_memalloc_sizeclasses_t::numplain==14, "IOT_MEMALLOC_SIZECLASSES must have 13 items");
+static_assert(iot_memalloc_sizeclasses_t::is_valid(), "IOT_MEMALLOC_SIZECLASSES must be ascending multiples of IOT_MEMALLOC_SIZEGRANULE");
+
+enum iot_memarena_mode_t : uint8_t { //source of OS memory for freelist chunks
+	IOT_MEMARENA_MALLOC=0, //each chunk is allocated by malloc()
+	IOT_MEMARENA_MMAP, //chunks are carved from large regions reserved by mmap()
+	IOT_MEMARENA_HUGEPAGE //same as IOT_MEMARENA_MMAP but regions are advised with MADV_HUGEPAGE
+};
+
+//default size of one arena region
+#define IOT_MEMARENA_REGIONSIZE (64*1024*1024)
+
+//Carves chunks for freelists of one allocator from large regions reserved by anonymous mmap(). Released chunks are returned to OS
+//with MADV_DONTNEED but their address range is kept for reuse by chunks of same size. Used by allocating thread only
+class iot_memarena {
+	static iot_memarena_mode_t mode;
+	static size_t regionsize; //size of each region, multiple of huge page size
+
+	struct region_t {
+		char *base;
+		size_t used; //offset of first never used byte in region
+	} *regions; //array of reserved regions
+	uint32_t numregions, maxregions;
+	struct extent_t {
+		char *ptr;
+		uint32_t size;
+	} *freeextents; //array of released chunks available for reuse
+	uint32_t numfree, maxfree;
+	uint64_t usedbytes; //total size of chunks given out
+
+public:
+	iot_memarena(void) : regions(NULL), numregions(0), maxregions(0), freeextents(NULL), numfree(0), maxfree(0), usedbytes(0) {
+	}
+	~iot_memarena(void) {
+		deinit();
+	}
+	static void set_mode(iot_memarena_mode_t m, size_t rsize=IOT_MEMARENA_REGIONSIZE); //must be called before any additional threads are started
+	static iot_memarena_mode_t get_mode(void) {
+		return mode;
+	}
+	void* allocate(uint32_t size); //returns page-aligned chunk or NULL if arena is disabled, chunk is too large or OS refused to give memory
+	bool release(void* ptr, uint32_t size); //returns chunk to arena. 'size' must be same as during allocation. returns false if ptr does not belong to arena
+	bool owns(const void* ptr) const;
+	uint64_t get_reserved(void) const {
+		return uint64_t(numregions)*regionsize;
+	}
+	uint64_t get_used(void) const {
+		return usedbytes;
+	}
+	void deinit(void); //unmaps all regions
+};
+
+//default number of blocks of same freelist which are collected by thread before returning them to allocator of another thread
+#define IOT_MEMALLOC_REMOTEFREE_BATCH 32
+
+//number of free blocks of every plain freelist which allocating thread keeps in private LIFO cache (magazine) without atomic operations.
+//magazine is refilled from and drained to freelist by half of this value
+#ifndef IOT_MEMALLOC_MAGAZINESIZE
+#define IOT_MEMALLOC_MAGAZINESIZE 32
+#endif
+static_assert(IOT_MEMALLOC_MAGAZINESIZE>=2 && IOT_MEMALLOC_MAGAZINESIZE%2==0, "IOT_MEMALLOC_MAGAZINESIZE must be even and positive");
+
+//identifiers of typed object pools (see iot_objpool). every allocator has queue of objects returned to pool of its thread for each identifier
+enum iot_objpool_id_t : uint8_t {
+	IOT_OBJPOOL_THREADMSG,
+	IOT_OBJPOOL_MODELSIGNAL,
+	IOT_OBJPOOL_INPUTSUPDATE,
+
+	IOT_OBJPOOL_NUMIDS
+};
+
 //Manages memory allocations for one thread. Allows to release allocated blocks from any thread
 class /*alignas(IOT_MEMOBJECT_PARENT_ALIGN)*/ iot_memallocator {
-	static const uint32_t objsizes[15]; //size of allocated objects for corresponding freelist
-	static const uint32_t objoptblock[15]; //optimal size of OS-allocated block for corresponding freelist
+	friend struct iot_memallocator_remotecache;
+	static constexpr const uint32_t *objsizes=iot_memalloc_sizeclasses_t::objsizes; //size of allocated objects for corresponding freelist
+	static constexpr const uint32_t *objoptblock=iot_memalloc_sizeclasses_t::objoptblock; //optimal size of OS-allocated block for corresponding freelist
+	static uint32_t trim_watermark[15]; //maximum size in bytes of freelist which is kept by trim(). zero means objoptblock[] value
+	static uint32_t remotefree_batch; //number of blocks released to allocator of another thread which are collected before pushing them to freelist. 1 disables batching
 	mpsc_queue<iot_memobject, iot_memobject, &iot_memobject::next> freelist[15];
 
 	volatile std::atomic<int32_t> totalinfly={0}; //incremented during block allocation and decremented during release
+	volatile std::atomic<int32_t> remotecached={0}; //number of entries with released blocks in remote caches of other threads (see iot_memallocator_remotecache)
 	uv_thread_t thread={}; //which thread can do allocations
 
 	void **memchunks; //array of OS-allocated memory chunks
 	int32_t *memchunks_refs; //for each OS-allocated chunk keeps total number of blocks in use and in freelist, so 0 means that chunk can be freed. for holes == -2
 	uint32_t nummemchunks, maxmemchunks; //current quantity of chunk pointers in memchunks, number of allocated items in memchunks array
 	volatile std::atomic<uint32_t> numholes; //current number of holes in memchunks array (they appear during freeing OS-allocated blocks)
+	iot_memarena arena; //source of freelist chunks when mmap() arena is enabled
+	mpsc_queue<iot_memobject, iot_memobject, &iot_memobject::next> objpool_returns[IOT_OBJPOOL_NUMIDS]; //constructed objects of typed pools released by
+																		//foreign threads. blocks stay in use and are linked through header, so parent is restored when taken
+	volatile std::atomic<uint32_t> objpool_numreturned[IOT_OBJPOOL_NUMIDS]={}; //number of objects in corresponding objpool_returns queue
+
+	struct { //private cache of free blocks for each plain freelist. accessed by allocating thread only. blocks in it are considered free by statistics
+		iot_memobject* items[IOT_MEMALLOC_MAGAZINESIZE];
+		uint32_t numitems;
+	} magazines[14]={};
+
+	struct { //statistics counters for each freelist. index 15 is for direct allocations
+		uint64_t allocs, misses, carved, local_releases; //updated by allocating thread only. 'carved' - number of blocks carved from OS-allocated chunks
+		uint32_t chunks; //number of OS-allocated chunks for freelist. updated by allocating thread only
+		volatile std::atomic<uint64_t> remote_releases; //updated by foreign threads
+	} stats[16]={};
 public:
 	const uint32_t signature=IOT_MEMOBJECT_SIGNATURE;
 
@@ -73,6 +218,12 @@ public:
 	void set_thread(uv_thread_t th) {
 		thread=th;
 	}
+	static iot_memallocator* get_parent(const void* memblock) { //returns allocator which owns memory block
+		return ((const iot_memobject*)container_of(memblock, const struct iot_memobject, data))->parent;
+	}
+	bool is_unused(void) const { //checks that no blocks are in use or in remote caches of other threads, so allocator can be destroyed
+		return totalinfly.load(std::memory_order_acquire)==0 && remotecached.load(std::memory_order_acquire)==0;
+	}
 	iot_membuf_chain* allocate_chain(uint32_t size);
 	void* allocate(uint32_t size, bool allow_direct=false); //true allow_direct says that block can be malloced directly without going to freelist on release. can be used for rarely realloced buffers
 	bool incref(void* ptr); //increase object's reference count if possible (returns true). max number of refs is IOT_MEMOBJECT_MAXREF. can be called from any thread
@@ -80,18 +231,108 @@ public:
 
 	iot_threadmsg_t *allocate_threadmsg(void); //allocates threadmsg structure as memblock and inits is properly
 
+	bool objpool_return(iot_objpool_id_t poolid, void* ptr, uint32_t maxreturned) { //queues object of typed pool for reuse by allocating thread. returns
+																					//false if queue has 'maxreturned' objects, so block must be released. can be called from any thread
+		if(objpool_numreturned[poolid].fetch_add(1, std::memory_order_relaxed)>=maxreturned) {
+			objpool_numreturned[poolid].fetch_sub(1, std::memory_order_relaxed);
+			return false;
+		}
+		objpool_returns[poolid].push((iot_memobject*)container_of(ptr, struct iot_memobject, data)); //overwrites parent pointer
+		return true;
+	}
+	void* objpool_take(iot_objpool_id_t poolid) { //returns object queued by objpool_return() or NULL. only allocating thread (or any single thread after its exit) can call
+		iot_memobject* obj=objpool_returns[poolid].pop();
+		if(!obj) return NULL;
+		objpool_numreturned[poolid].fetch_sub(1, std::memory_order_relaxed);
+		obj->parent=this;
+		return obj->data;
+	}
+
+	void get_stats(iot_memstats_t* st) const; //fills statistics struct. can be called from any thread, but values are approximate if not called by allocating thread
+
+	void report_inflight(void); //logs blocks in use grouped by allocation backtrace (in debug build) or by freelist. only allocating thread can call
+	uint32_t trim(void); //returns to OS chunks whose blocks are all in freelist for freelists larger than their watermark. returns number of freed chunks. only allocating thread can call
+	static void set_trim_watermark(unsigned listidx, uint32_t bytes) { //sets watermark for trim(). must be called before any additional threads are started
+		assert(listidx<15);
+		trim_watermark[listidx]=bytes;
+	}
+	static void set_remotefree_batch(uint32_t n) { //sets batch size for releases from foreign threads. must be called before any additional threads are started
+		remotefree_batch=n>0 ? n : 1;
+	}
+	static void flush_remote_releases(void); //pushes blocks collected by current thread during releases to allocators of other threads. must be called
+											//periodically (e.g. after each event loop iteration) by any thread which can release blocks
+
 private:
 	void deinit(void); //free all OS-allocated chunks
-	void do_free_direct(uint16_t &chunkindex);
-	void *do_allocate_direct(uint32_t size, uint16_t &chunkindex); //returns NULL on allocation error
-	bool do_allocate_freelist(uint32_t &n, uint32_t sz, iot_memobject * &ret, uint32_t OPTIMAL_BLOCK=64*1024, uint32_t MAX_BLOCK=2*1024*1024,unsigned maxn=0xFFFFFFFF);
+	iot_memobject* refill_magazine(unsigned listidx); //moves up to half of magazine capacity of blocks from freelist to magazine and returns
+														//one more block. returns NULL if freelist is empty
+	void drain_magazine(unsigned listidx, uint32_t n); //moves 'n' oldest blocks from magazine to freelist by single push_list()
+	void do_free_direct(uint16_t chunkindex, uint32_t size=0); //'size' must be provided for freelist chunks which can come from arena
+	void *do_allocate_direct(uint32_t size, uint16_t &chunkindex, bool use_arena=false); //returns NULL on allocation error. 'use_arena' allows
+																						//to take memory from arena (for freelist chunks)
+	bool do_allocate_freelist(uint32_t &n, unsigned listidx, iot_memobject * &ret, uint32_t MAX_BLOCK=2*1024*1024,unsigned maxn=0xFFFFFFFF);
 		//'n' - minimal amount to be allocated for success. on exit it is updated to show quantity of allocated items
-		//'sz' - size of each item
+		//'listidx' - index of freelist which determines size of each item and optimal size of OS-allocated chunk
 		//'ret' - head of allocated unidirectional list of items will be put here. if 'ret' already has pointer to unidirectional list, this list will be prepended
 		//'maxn' - optional maximum quantity of allocated items
 		//returns false if 'n' was not satisfied (but less structs can be allocated and returned with 'n' updated to show quantity of allocated)
 };
 
+//Per-thread cache of constructed objects of type T allocated as memblocks. Cached objects keep their memblock reference, so construction
+//(including vtable setup) is done once per block and get()/put() do not touch allocator freelists. Objects put by thread which does not own their
+//allocator are returned to queue of that allocator (up to MaxCached objects) and taken by get() of owning thread when its own cache is empty, so
+//objects allocated in one thread and released in another are reused too. get() can return object for requests to allocator of current thread only.
+//Cache is flushed automatically on thread exit, but threads which exit before their allocator is destroyed must call flush() explicitly. Objects
+//returned after that must be released by drain() before allocator is destroyed
+template<class T, uint32_t MaxCached, iot_objpool_id_t PoolId> class iot_objpool {
+	struct cache_t {
+		T* items[MaxCached];
+		uint32_t numitems;
+
+		~cache_t(void) {
+			flush();
+		}
+		void flush(void) {
+			while(numitems>0) {
+				T* obj=items[--numitems];
+				obj->~T();
+				iot_release_memblock(obj);
+			}
+		}
+	};
+	static thread_local cache_t cache; //zero-inited for every thread
+
+public:
+	static T* get(iot_memallocator* allocator) { //returns cached object in the state it was put or NULL if cache is empty or 'allocator' is not
+													//allocator of current thread
+		if(allocator!=iot_current_allocator()) return NULL;
+		if(cache.numitems>0) return cache.items[--cache.numitems];
+		return (T*)allocator->objpool_take(PoolId);
+	}
+	static bool put(T* obj) { //caches object or returns it to pool of thread which owns its allocator. returns false if cache or queue is full, so it
+								//must be released by caller
+		iot_memallocator* parent=iot_memallocator::get_parent(obj);
+		if(parent!=iot_current_allocator()) return parent->objpool_return(PoolId, obj, MaxCached);
+		if(cache.numitems>=MaxCached) return false;
+		cache.items[cache.numitems++]=obj;
+		return true;
+	}
+	static void flush(void) { //destroys and releases all objects cached by current thread or returned to its allocator
+		cache.flush();
+		iot_memallocator* allocator=iot_current_allocator();
+		if(allocator) drain(allocator);
+	}
+	static void drain(iot_memallocator* allocator) { //destroys and releases objects returned to 'allocator'. must be called by thread of allocator or after its exit
+		T* obj;
+		while((obj=(T*)allocator->objpool_take(PoolId))) {
+			obj->~T();
+			iot_release_memblock(obj);
+		}
+	}
+};
+template<class T, uint32_t MaxCached, iot_objpool_id_t PoolId> thread_local typename iot_objpool<T, MaxCached, PoolId>::cache_t iot_objpool<T, MaxCached, PoolId>::cache;
+
+
 template<class Key1, class Key2, class Value> struct dbllist_node { //represents node which is member of two bi-dir. linked lists with tail
 	dbllist_node *next[2], *prev[2]; //index i - to organize list of nodes with equal Key[i]
 	Key1 key1;
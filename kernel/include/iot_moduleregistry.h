@@ -128,13 +128,22 @@ struct iot_modinstance_item_t {
 	iot_module_instance_base *instance;
 	uint64_t started; //non-zero if instance was requested to start. this property is assigned in main thread.
 	uint64_t state_timeout; //for state-related delayed tasks time of recheck (exact task is determined by state/target_state)
-	iot_atimer_item instrecheck_timer; //used to recheck all delayed tasks by checking all error states
+	iot_atimer_item instrecheck_timer; //used to recheck all delayed tasks by checking all error states. belongs to timer wheel of instance thread, so is (un)scheduled in that thread only
 	int aborted_error; //contains abortion error code in case modinst aborted itself
 
 	volatile iot_modinstance_state_t state; //inited to IOT_MODINSTSTATE_INITED main thread, updated in working thread
 	volatile iot_modinstance_state_t target_state; //assigned in main or working thread
 	iot_modinstance_type_t type;
 	uint8_t cpu_loading; //copied from corresponding iface from module's config
+	uint16_t cpu_load; //current estimation of CPU load of instance in IOT_THREAD_LOADING_MAX units. starts from declared cpu_loading and then follows measured
+						//CPU usage with exponential decay. assigned in main thread
+	volatile std::atomic<uint64_t> cpu_time; //thread CPU time in nanoseconds spent in message handlers of instance. updated in working thread
+	uint64_t cpu_time_seen; //value of cpu_time at previous update of cpu_load. main thread only
+	uint64_t cpu_total; //total CPU time in nanoseconds attributed to instance (including share of thread time outside message handlers). main thread only
+	uint64_t placed_time; //uv_now(main_loop) when instance was added to current thread. main thread only
+	iot_thread_item_t *migrate_from; //thread from which instance is being migrated or NULL. main thread only
+	bool is_migratable; //copied from corresponding iface from module's config
+	uint16_t pending_jobs; //number of jobs started by kapi_run_blocking() and not finished. instance is kept locked while it is non-zero. working thread only
 	volatile std::atomic_flag stopmsglock; //lock protecting access to msgp.stop
 	union {
 		struct {
@@ -171,9 +180,9 @@ struct iot_modinstance_item_t {
 		~modinsttype_data_t(void) {} //to make compiler happy
 	} data;
 private:
-	volatile std::atomic_flag acclock; //lock protecting access to next 2 fields
+	iot_spinlock acclock; //lock protecting access to next 2 fields
 	int8_t refcount; //how many times this struct was locked. can be accessed under acclock only
-	uint8_t pendfree; //flag that this struct in waiting for zero in refcount to be freed. can be accessed under acclock only
+	std::atomic<uint8_t> pendfree; //flag that this struct in waiting for zero in refcount to be freed. modified under acclock only, but can be read without lock by is_pendfree()
 	iot_miid_t miid; //module instance id (index in iot_modinstances array and creation time). zero iid field indicates unused structure.
 	bool in_recheck_job;
 
@@ -191,35 +200,28 @@ public:
 		return state==IOT_MODINSTSTATE_STARTED || state==IOT_MODINSTSTATE_STOPPING;
 	}
 	bool lock(void) { //tries to lock structure from releasing. returns true if structure can be accessed
-		uint8_t c=0;
-		while(acclock.test_and_set(std::memory_order_acquire)) {
-			//busy wait
-			c++;
-			if((c & 0x3F)==0x3F) sched_yield();
-		}
-		if(pendfree) { //cannot be locked
-			acclock.clear(std::memory_order_release);
+		acclock.lock(IOT_SPINSITE_MODINST_LOCK);
+		if(pendfree.load(std::memory_order_relaxed)) { //cannot be locked
+			acclock.unlock();
 			return false;
 		}
 		assert(refcount<100);
 		refcount++;
-		acclock.clear(std::memory_order_release);
+		acclock.unlock();
 		return true;
 	}
 	bool mark_pendfree(void) { //marks structure as pending to be freed and returns true if it can be freed immediately (when refcount is zero)
-		uint8_t c=0;
 		bool canfree=false;
-		while(acclock.test_and_set(std::memory_order_acquire)) {
-			//busy wait
-			c++;
-			if((c & 0x3F)==0x3F) sched_yield();
-		}
-		pendfree=1;
+		acclock.lock(IOT_SPINSITE_MODINST_LOCK);
+		pendfree.store(1, std::memory_order_release);
 		if(refcount==0) canfree=true;
-		acclock.clear(std::memory_order_release);
+		acclock.unlock();
 		return canfree;
 	}
 	void unlock(void); //unlocked previously locked structure. CANNOT BE called if lock() returned false
+	bool is_pendfree(void) const { //checks if structure is waiting to be freed, so new locks are impossible. used by holders of lock to decide if lock can be reused
+		return pendfree.load(std::memory_order_acquire)!=0;
+	}
 /*	iot_threadmsg_t* try_get_msgreserv(void) { //tries to lock and returns iot_threadmsg_t struct from statically allocated reserv. returns NULL if no available
 		//can work in any thread
 		for(int i=0;i<IOT_MSGSTRUCTS_PER_MODINST;i++) {
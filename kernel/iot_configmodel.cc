@@ -261,6 +261,7 @@ void iot_nodemodel::destroy(iot_nodemodel* node) {
 		node->curmsginput=NULL;
 		node->curmsgoutput=NULL;
 	}
+	if(node->deferred_signals) iot_modelsignal::release(node->deferred_signals);
 	if(node->modinstlk) node->modinstlk.unlock();
 	iot_release_memblock(node);
 }
@@ -551,13 +552,13 @@ int iot_nodemodel::do_update_outputs(const iot_event_id_t *reason_eventid, uint8
 			sig=syncexec.prealloc_signals;
 			syncexec.prealloc_signals=sig->next;
 		} else { //need allocation
-			sig=(iot_modelsignal*)allocator->allocate(sizeof(iot_modelsignal));
+			sig=iot_modelsignal::acquire(allocator);
 			if(!sig) {
 				if(newvalue) newvalue->release();
 				goto nomem;
 			}
 		}
-		sig=new(sig) iot_modelsignal(this, node_iface->valueoutput[valueout_indexes[i]].label, tm, newvalue, /*sync!=0,*/ reason_eventid);
+		sig->init(this, node_iface->valueoutput[valueout_indexes[i]].label, tm, newvalue, /*sync!=0,*/ reason_eventid);
 		sig->next=outsignals;
 		outsignals=sig;
 	}
@@ -577,13 +578,13 @@ int iot_nodemodel::do_update_outputs(const iot_event_id_t *reason_eventid, uint8
 			sig=syncexec.prealloc_signals;
 			syncexec.prealloc_signals=sig->next;
 		} else { //need allocation
-			sig=(iot_modelsignal*)allocator->allocate(sizeof(iot_modelsignal));
+			sig=iot_modelsignal::acquire(allocator);
 			if(!sig) {
 				if(newmsg) newmsg->release();
 				goto nomem;
 			}
 		}
-		sig=new(sig) iot_modelsignal(this, node_iface->msgoutput[msgout_indexes[i]].label, tm, newmsg, /*sync!=0,*/ reason_eventid);
+		sig->init(this, node_iface->msgoutput[msgout_indexes[i]].label, tm, newmsg, /*sync!=0,*/ reason_eventid);
 		sig->next=outsignals;
 		outsignals=sig;
 	}
@@ -591,7 +592,12 @@ int iot_nodemodel::do_update_outputs(const iot_event_id_t *reason_eventid, uint8
 	if(!sync) { //allocate, fill and send thread msg
 		iot_threadmsg_t* msg=NULL;
 		int err=0;
-		if(outsignals) {
+		if(outsignals && !node_iface->is_sync && (deferred_signals || main_thread_item->is_congested())) { //modeller is overloaded or older signals
+																										//still wait, so coalesce with them to keep order
+			defer_outputs(outsignals);
+			outsignals=NULL;
+			flush_deferred_outputs();
+		} else if(outsignals) {
 			err=iot_prepare_msg_releasable(msg, IOT_MSG_EVENTSIG_OUT, NULL, 0, static_cast<iot_releasable*>(outsignals), 0, IOT_THREADMSG_DATAMEM_MEMBLOCK_NOOPT, true, allocator);
 		} else if(reason_eventid && reason_eventid->numerator>0 && node_iface->is_sync) { //this can be disordered reply to old sync execution
 			iot_modelnegsignal neg={event_id : *reason_eventid, node_id : node_id};
@@ -627,6 +633,51 @@ nomem:
 	return IOT_ERROR_NO_MEMORY;
 }
 
+void iot_nodemodel::defer_outputs(iot_modelsignal* outsignals) {
+	assert(modinstlk.modinst!=NULL);
+	assert(uv_thread_self()==modinstlk.modinst->thread->thread);
+	while(outsignals) {
+		iot_modelsignal* sig=outsignals;
+		outsignals=sig->next;
+		sig->next=NULL;
+		iot_modelsignal **pnext=&deferred_signals;
+		while(*pnext) {
+			iot_modelsignal* cur=*pnext;
+			if(sig->out_label[0]=='v' && strcmp(cur->out_label, sig->out_label)==0) { //older value of same output is not necessary
+				*pnext=cur->next;
+				cur->next=NULL;
+				iot_modelsignal::release(cur);
+				continue;
+			}
+			pnext=&cur->next;
+		}
+		*pnext=sig; //add to tail to preserve order of messages
+	}
+}
+
+void iot_nodemodel::flush_deferred_outputs(void) {
+	assert(modinstlk.modinst!=NULL);
+	iot_thread_item_t* thread=modinstlk.modinst->thread;
+	assert(uv_thread_self()==thread->thread);
+	if(!deferred_signals) return;
+	if(!cfgitem) { //model is being stopped and is already detached from config item. signals are not needed
+		iot_modelsignal::release(deferred_signals);
+		return;
+	}
+	iot_thread_item_t::bpretry_t retry={iot_thread_item_t::bpretry_t::RETRY_NODE_OUTPUTS, iot_connid_t(), modinstlk.modinst->get_miid()};
+	if(main_thread_item->is_congested() && thread->defer_to(main_thread_item, retry)) return;
+
+	iot_threadmsg_t* msg=NULL;
+	int err=iot_prepare_msg_releasable(msg, IOT_MSG_EVENTSIG_OUT, NULL, 0, static_cast<iot_releasable*>(deferred_signals), 0, IOT_THREADMSG_DATAMEM_MEMBLOCK_NOOPT, true, thread->allocator);
+	if(err) {
+		assert(err==IOT_ERROR_NO_MEMORY);
+		thread->defer_to(main_thread_item, retry); //try again later
+		return;
+	}
+	deferred_signals=NULL;
+	main_thread_item->send_msg(msg);
+}
+
 const iot_valuetype_BASE* iot_nodemodel::get_outputvalue(uint8_t index) {
 	assert(modinstlk.modinst!=NULL);
 	assert(uv_thread_self()==modinstlk.modinst->thread->thread);
@@ -635,9 +686,12 @@ const iot_valuetype_BASE* iot_nodemodel::get_outputvalue(uint8_t index) {
 }
 
 
-iot_modelsignal::iot_modelsignal(iot_nodemodel *model, const char* out_labeln, uint64_t reltime, const iot_datatype_base* msgval, /*bool is_sync,*/ const iot_event_id_t* reason) : 
-	reltime(reltime), data(msgval)/*, is_sync(is_sync)*/ {
+void iot_modelsignal::init(iot_nodemodel *model, const char* out_labeln, uint64_t reltime_, const iot_datatype_base* msgval, /*bool is_sync,*/ const iot_event_id_t* reason) {
 		assert(model->cfgitem!=NULL);
+		assert(data==NULL); //signal must be constructed or released. 'next' is managed by caller
+		reltime=reltime_;
+		data=msgval;
+		node_out=NULL;
 		node_id=model->node_id;
 		module_id=model->cfgitem->module_id;
 		if(reason) reason_event=*reason;
@@ -1002,9 +1002,8 @@ bool iot_config_item_node_t::prepare_execute(bool forceasync) { //must be called
 				//real_index can be negative here but it can become valid during execute()
 				//ensure there is preallocated signal struct
 				if(!out->prealloc_signal) {
-					out->prealloc_signal=(iot_modelsignal*)main_allocator.allocate(sizeof(iot_modelsignal));
+					out->prealloc_signal=iot_modelsignal::acquire(&main_allocator);
 					if(!out->prealloc_signal) return false;
-					out->prealloc_signal=new(out->prealloc_signal) iot_modelsignal();
 				}
 			}
 		}
@@ -1023,14 +1022,14 @@ bool iot_config_item_node_t::prepare_execute(bool forceasync) { //must be called
 		} else notifyupdate=NULL;
 
 		if(!notifyupdate) {
-			size_t sz=iot_notify_inputsupdate::calc_size(num_insignals);
-			alignas(iot_notify_inputsupdate) char notifyupdatebuf[sz];
-			notifyupdate=new(notifyupdatebuf) iot_notify_inputsupdate(num_insignals);
+			notifyupdate=iot_notify_inputsupdate::acquire(num_insignals, &main_allocator);
+			if(!notifyupdate) return false;
 
-			int err=iot_prepare_msg_releasable(prealloc_execmsg, IOT_MSG_NOTIFY_INPUTSUPDATED, NULL, 0, notifyupdate, sz, IOT_THREADMSG_DATAMEM_TEMP, false, &main_allocator);
+			int err=iot_prepare_msg_releasable(prealloc_execmsg, IOT_MSG_NOTIFY_INPUTSUPDATED, NULL, 0, notifyupdate, notifyupdate->get_size(), IOT_THREADMSG_DATAMEM_MEMBLOCK_NOOPT, false, &main_allocator);
 			//miid and bytearg MUST BE ASSIGNED correctly before sending msg
 			if(err) {
 				assert(err==IOT_ERROR_NO_MEMORY);
+				if(!notifyupdate->recycle()) iot_release_memblock(notifyupdate);
 				return false;
 			}
 		}
@@ -955,11 +955,16 @@ void iot_device_connection_t::c2d_ready(void) { //called by client after writing
 	if(!msg) return; //message is already in fly
 
 	if(driver_host==iot_current_hostid) {
+		iot_thread_item_t* thread=driver.local.modinstlk.modinst->thread;
+		if(thread->is_congested()) { //driver thread is overloaded, so notify later. all data written till then will be reported by single message
+			iot_thread_item_t::bpretry_t retry={iot_thread_item_t::bpretry_t::RETRY_C2D_READY, connident, iot_miid_t()};
+			if(client.local.modinstlk.modinst->thread->defer_to(thread, retry)) return;
+		}
 		int err=iot_prepare_msg(msg, IOT_MSG_CONNECTION_C2D_READY, NULL, 0, &connident, sizeof(connident), IOT_THREADMSG_DATAMEM_TEMP, true);
 		assert(err==0);
 		c2d_ready_msg=NULL;
 
-		driver.local.modinstlk.modinst->thread->send_msg(msg);
+		thread->send_msg(msg);
 	} else if(driver_host) {
 		//todo for remote
 		assert(false);
@@ -1157,11 +1162,16 @@ void iot_device_connection_t::d2c_ready(void) { //called by driver after writing
 	if(!msg) return; //message is already in fly
 
 	if(client_host==iot_current_hostid) {
+		iot_thread_item_t* thread=client.local.modinstlk.modinst->thread;
+		if(thread->is_congested()) { //client thread is overloaded, so notify later. all data written till then will be reported by single message
+			iot_thread_item_t::bpretry_t retry={iot_thread_item_t::bpretry_t::RETRY_D2C_READY, connident, iot_miid_t()};
+			if(driver.local.modinstlk.modinst->thread->defer_to(thread, retry)) return;
+		}
 		int err=iot_prepare_msg(msg, IOT_MSG_CONNECTION_D2C_READY, NULL, 0, &connident, sizeof(connident), IOT_THREADMSG_DATAMEM_TEMP, true);
 		assert(err==0);
 		d2c_ready_msg=NULL;
 
-		client.local.modinstlk.modinst->thread->send_msg(msg);
+		thread->send_msg(msg);
 	} else if(client_host) {
 		//todo for remote
 		assert(false);
@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <time.h>
+#include <errno.h>
+#include <unistd.h>
 
 
 //#include "iot_compat.h"
@@ -90,6 +92,90 @@ int iot_module_instance_base::kapi_self_abort(int errcode) { //can be called in
 	return modinst->stop(false, true);
 }
 
+struct iot_blockingjob_t { //job started by kapi_run_blocking()
+	uv_work_t req;
+	iot_modinstance_item_t* modinst;
+	void (*work)(void* arg);
+	void (*done)(void* arg, int status);
+	void* arg;
+	uint64_t queued, started, finished; //uv_hrtime() when job was queued, started and finished in pool thread
+};
+
+static void iot_blockingjob_run(uv_work_t* req) { //runs in libuv pool thread
+	iot_blockingjob_t* job=(iot_blockingjob_t*)req->data;
+	job->started=uv_hrtime();
+	job->work(job->arg);
+	job->finished=uv_hrtime();
+}
+
+static void iot_blockingjob_done(uv_work_t* req, int status) { //runs in instance thread
+	iot_blockingjob_t* job=(iot_blockingjob_t*)req->data;
+	iot_modinstance_item_t* modinst=job->modinst;
+	iot_thread_item_t* thread_item=modinst->thread;
+	assert(uv_thread_self()==thread_item->thread);
+
+	if(msgstats_interval && status==0) {
+		if(!thread_item->jobstats) thread_item->jobstats=(iot_thread_item_t::jobstats_t*)calloc(1, sizeof(iot_thread_item_t::jobstats_t));
+		if(thread_item->jobstats) {
+			uint64_t wait=(job->started-job->queued)/1000, run=(job->finished-job->started)/1000;
+			thread_item->jobstats->wait.record(wait>UINT32_MAX ? UINT32_MAX : uint32_t(wait));
+			thread_item->jobstats->run.record(run>UINT32_MAX ? UINT32_MAX : uint32_t(run));
+		}
+	}
+	auto done=job->done;
+	void* arg=job->arg;
+	iot_release_memblock(job);
+
+	done(arg, status==0 && modinst->is_working() ? 0 : IOT_ERROR_ACTION_CANCELLED);
+
+	assert(modinst->pending_jobs>0);
+	if(!--modinst->pending_jobs) modinst->unlock(); //instance can be freed after this
+}
+
+int iot_module_instance_base::kapi_run_blocking(void (*work)(void* arg), void (*done)(void* arg, int status), void* arg) { //can be called in modinstance thread
+	if(!work || !done) return IOT_ERROR_INVALID_ARGS;
+	iot_modinstance_locker modinstlk=modules_registry->get_modinstance(miid);
+	if(!modinstlk || modinstlk.modinst->instance!=this) {
+		assert(false);
+		return IOT_ERROR_NOT_READY;
+	}
+	iot_modinstance_item_t* modinst=modinstlk.modinst;
+	assert(uv_thread_self()==modinst->thread->thread);
+
+	if(modinst->target_state!=IOT_MODINSTSTATE_STARTED || modinst->state==IOT_MODINSTSTATE_HUNG) return IOT_ERROR_NOT_READY;
+	if(modinst->pending_jobs>=IOT_WORKPOOL_MAXJOBS) return IOT_ERROR_LIMIT_REACHED;
+
+	iot_blockingjob_t* job=(iot_blockingjob_t*)iot_allocate_memblock(sizeof(iot_blockingjob_t), true);
+	if(!job) return IOT_ERROR_NO_MEMORY;
+	job->req.data=job;
+	job->modinst=modinst;
+	job->work=work;
+	job->done=done;
+	job->arg=arg;
+	job->queued=uv_hrtime();
+	job->started=job->finished=job->queued;
+
+	int err=uv_queue_work(modinst->thread->loop, &job->req, iot_blockingjob_run, iot_blockingjob_done);
+	if(err) {
+		outlog_error("Cannot queue blocking job of %s instance %u: %s", iot_modinsttype_name[modinst->type], unsigned(miid.iid), uv_strerror(err));
+		iot_release_memblock(job);
+		return IOT_ERROR_NO_MEMORY;
+	}
+	if(!modinst->pending_jobs++) modinstlk.modinst=NULL; //lock is kept till last job is done, so instance is not freed with pending jobs
+	return 0;
+}
+
+int iot_module_instance_base::kapi_timer_start(iot_atimer_item &timer, uint64_t delay, uint64_t slack) { //can be called in modinstance thread
+	if(!timer.notify) return IOT_ERROR_INVALID_ARGS;
+	iot_thread_item_t* thread_item=iot_thread_item_t::current;
+	if(!thread_item || thread_item->thread!=thread) {
+		assert(false);
+		return IOT_ERROR_INVALID_THREAD;
+	}
+	thread_item->schedule_atimer(timer, delay, slack);
+	return 0;
+}
+
 int iot_node_base::kapi_update_outputs(const iot_event_id_t *reason_eventid, uint8_t num_values, const uint8_t *valueout_indexes, const iot_valuetype_BASE** values, uint8_t num_msgs, const uint8_t *msgout_indexes, const iot_msgtype_BASE** msgs) {
 	iot_modinstance_locker modinstlk=modules_registry->get_modinstance(miid);
 	if(!modinstlk || modinstlk.modinst->instance!=this) {
@@ -126,6 +212,89 @@ uv_loop_t* kapi_get_event_loop(uv_thread_t thread) {
 	return thread_registry->find_loop(thread);
 }
 
+int kapi_get_memstats(uv_thread_t thread, iot_memstats_t* st) {
+	assert(uv_thread_self()==main_thread);
+	if(!st) return IOT_ERROR_INVALID_ARGS;
+	iot_memallocator* allocator=thread_registry->find_allocator(thread ? thread : uv_thread_self());
+	if(!allocator) return IOT_ERROR_NOT_FOUND;
+	allocator->get_stats(st);
+	return 0;
+}
+
+void kapi_report_memblocks(void) {
+	assert(uv_thread_self()==main_thread);
+	thread_registry->report_memblocks();
+}
+
+#define IOT_MEMBUF_CHAIN_MAXIOV 64 //max number of segments passed to one writev/readv/uv_write call from stack array
+
+ssize_t iot_membuf_chain_writev(int fd, const iot_membuf_chain* chain, uint32_t offset, uint32_t datalen) {
+	assert(chain!=NULL);
+	struct iovec iov[IOT_MEMBUF_CHAIN_MAXIOV];
+	size_t total=0;
+	if(offset>=chain->total_len) return 0;
+	if(datalen>chain->total_len-offset) datalen=chain->total_len-offset;
+	while(datalen>0) {
+		uint32_t covered;
+		unsigned n=chain->fill_iovec(iov, IOT_MEMBUF_CHAIN_MAXIOV, offset, datalen, &covered);
+		assert(n>0);
+		ssize_t res=writev(fd, iov, int(n));
+		if(res<0) {
+			if(errno==EINTR) continue;
+			if(errno==EAGAIN || errno==EWOULDBLOCK) break;
+			if(total>0) break;
+			return -errno;
+		}
+		total+=size_t(res);
+		offset+=uint32_t(res);
+		datalen-=uint32_t(res);
+		if(uint32_t(res)<covered) break; //partial write means that fd cannot accept more data now
+	}
+	return ssize_t(total);
+}
+
+ssize_t iot_membuf_chain_readv(int fd, iot_membuf_chain* chain, uint32_t offset, uint32_t maxlen) {
+	assert(chain!=NULL);
+	struct iovec iov[IOT_MEMBUF_CHAIN_MAXIOV];
+	size_t total=0;
+	if(offset>=chain->total_len) return 0;
+	if(maxlen>chain->total_len-offset) maxlen=chain->total_len-offset;
+	while(maxlen>0) {
+		uint32_t covered;
+		unsigned n=chain->fill_iovec(iov, IOT_MEMBUF_CHAIN_MAXIOV, offset, maxlen, &covered);
+		assert(n>0);
+		ssize_t res=readv(fd, iov, int(n));
+		if(res<0) {
+			if(errno==EINTR) continue;
+			if(errno==EAGAIN || errno==EWOULDBLOCK) break;
+			if(total>0) break;
+			return -errno;
+		}
+		if(res==0) break; //EOF
+		total+=size_t(res);
+		offset+=uint32_t(res);
+		maxlen-=uint32_t(res);
+		if(uint32_t(res)<covered) break; //no more data available now
+	}
+	return ssize_t(total);
+}
+
+int iot_membuf_chain_uvwrite(uv_write_t* req, uv_stream_t* stream, const iot_membuf_chain* chain, uint32_t offset, uint32_t datalen, uv_write_cb cb) {
+	if(!req || !stream || !chain) return UV_EINVAL;
+	uv_buf_t stackbufs[IOT_MEMBUF_CHAIN_MAXIOV];
+	uv_buf_t* bufs=stackbufs;
+	unsigned n=chain->count_segments(offset, datalen);
+	if(!n) return UV_EINVAL;
+	if(n>IOT_MEMBUF_CHAIN_MAXIOV) { //uv_write() copies array of buffers, so temporary one can be freed right after call
+		bufs=(uv_buf_t*)malloc(sizeof(uv_buf_t)*n);
+		if(!bufs) return UV_ENOMEM;
+	}
+	n=chain->fill_uvbufs(bufs, n, offset, datalen);
+	int err=uv_write(req, stream, bufs, n, cb);
+	if(bufs!=stackbufs) free(bufs);
+	return err;
+}
+
 
 const char* kapi_strerror(int err) {
 	switch(err) {
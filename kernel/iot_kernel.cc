@@ -1,5 +1,8 @@
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 #include <assert.h>
 
 //#include "iot_compat.h"
@@ -32,17 +35,28 @@ uv_thread_t main_thread=0;
 uv_loop_t *main_loop=NULL;
 volatile sig_atomic_t need_exit=0; //1 means graceful exit after getting SIGTERM or SIGUSR1, 2 means urgent exit after SIGINT or SIGQUIT
 int max_threads=10;
+uint32_t memtrim_interval=0;
+uint32_t msgstats_interval=0;
+uint32_t msgq_watermark=0;
+uint32_t cpuacct_interval=0;
+uint32_t rebalance_interval=0;
+uint32_t thread_idle_timeout=0;
+uint32_t workpool_size=0;
+iot_threadsetup_t thread_setup;
 
 uint32_t iot_thread_item_t::last_thread_id=0;
+thread_local iot_thread_item_t* iot_thread_item_t::current=NULL;
+thread_local iot_memallocator* iot_thread_item_t::current_allocator=NULL;
+thread_local uv_loop_t* iot_thread_item_t::current_loop=NULL;
 
 int iot_thread_item_t::init(bool ismain) {//, uv_loop_t* loop_, iot_memallocator* allocator_) {
 	int err;
-	uint32_t interval;
 	if(ismain) {
 		thread=main_thread;
 		allocator=&main_allocator;
 
 		loop=main_loop;
+		set_current();
 	} else {
 		allocator=new iot_memallocator;
 		if(!allocator) goto onerr;
@@ -56,47 +70,181 @@ int iot_thread_item_t::init(bool ismain) {//, uv_loop_t* loop_, iot_memallocator
 	uv_async_init(loop, &msgq_watcher, iot_thread_registry_t::on_thread_msg);
 	msgq_watcher.data=this;
 
-	interval=1*1000; //interval of first timer in milliseconds
-	for(unsigned i=0;i<sizeof(atimer_pool)/sizeof(atimer_pool[0]);i++) {
-		atimer_pool[i].timer.init(interval, loop);
-		interval*=2;
-	}
+	uv_timer_init(loop, &memtrim_watcher);
+	memtrim_watcher.data=this;
+	uv_unref((uv_handle_t*)&memtrim_watcher);
+
+	uv_check_init(loop, &remotefree_watcher);
+	uv_check_start(&remotefree_watcher, [](uv_check_t* w)->void {
+		iot_memallocator::flush_remote_releases();
+	});
+	uv_unref((uv_handle_t*)&remotefree_watcher);
+
+	uv_timer_init(loop, &bpretry_watcher);
+	bpretry_watcher.data=this;
+	uv_unref((uv_handle_t*)&bpretry_watcher);
+
+	timerwheel.init(IOT_THREAD_TIMERTICK, loop);
 
 	if(!ismain) {
+		err=start_thread();
+		if(err) goto onerr;
+	}
+
+	return 0;
+onerr:
+	deinit();
+	return IOT_ERROR_NO_MEMORY;
+}
+
+int iot_thread_item_t::start_thread(void) {
 #ifndef _WIN32
-		sigset_t myset, oldset;
-		sigfillset( &myset );
-		pthread_sigmask( SIG_SETMASK, &myset, &oldset ); //block all signals by default
+	sigset_t myset, oldset;
+	sigfillset( &myset );
+	pthread_sigmask( SIG_SETMASK, &myset, &oldset ); //block all signals by default
 #endif
-		err=uv_thread_create(&thread, [](void * arg) -> void {
-			iot_thread_item_t* thitem=(iot_thread_item_t*)arg;
-			thitem->thread_func();
+	int err=uv_thread_create(&thread, [](void * arg) -> void {
+		iot_thread_item_t* thitem=(iot_thread_item_t*)arg;
+		thitem->thread_func();
 
-		}, this);
+	}, this);
 
 #ifndef _WIN32
-		pthread_sigmask( SIG_SETMASK, &oldset, NULL ); //restore previous signal mask
+	pthread_sigmask( SIG_SETMASK, &oldset, NULL ); //restore previous signal mask
 #endif
-		if(err) goto onerr;
+	return err;
+}
+
+int iot_thread_item_t::restart(bool realtime) {
+	assert(uv_thread_self()==main_thread);
+	assert(this!=main_thread_item && !thread && loop!=NULL && is_shutdown);
+	assert(!instances_head && !hung_instances_head && !migrations_in);
+
+	//allocator is owned by main thread after exit, so it must stop releasing blocks locally before new thread starts allocating. new thread
+	//takes ownership in thread_func(). is_reclaimed is kept, as producers which have just seen is_shutdown set still check it
+	allocator->set_thread(uv_thread_t());
+	is_realtime=realtime;
+	is_draining=false;
+	idle_since=0;
+	cpu_time_seen=0;
+	is_shutdown.store(false, std::memory_order_release);
+	//messages sent after exit and not forwarded by main thread yet are processed by new thread (msgq_watcher is still signalled for them)
+	int err=start_thread();
+	if(err) {
+		thread=0;
+		is_shutdown.store(true, std::memory_order_release);
+		allocator->set_thread(main_thread);
+		return IOT_ERROR_NO_MEMORY;
 	}
+	return 0;
+}
+
+thread_local iot_threadmsg_batch* iot_threadmsg_batch::current=NULL;
 
+void iot_threadmsg_batch::do_add(iot_thread_item_t* thread, iot_threadmsg_t* msg) {
+	iot_threadmsg_lane_t lane=iot_msg_lane(msg->code);
+	msg->set_next(NULL);
+	for(unsigned i=0;i<numentries;i++) {
+		if(entries[i].thread!=thread || entries[i].lane!=lane) continue;
+		entries[i].tail->set_next(msg);
+		entries[i].tail=msg;
+		entries[i].count++;
+		return;
+	}
+	if(numentries>=sizeof(entries)/sizeof(entries[0])) { //must not happen, but deliver immediately instead of losing message
+		assert(false);
+		thread->send_msg_list(lane, msg, msg, 1);
+		return;
+	}
+	entries[numentries++]={thread, lane, msg, msg, 1};
+}
+
+void iot_threadmsg_batch::flush(void) {
+	for(unsigned i=0;i<numentries;i++) entries[i].thread->send_msg_list(entries[i].lane, entries[i].head, entries[i].tail, entries[i].count);
+	numentries=0;
+}
+
+static void flush_objpools(void) { //returns objects cached by typed pools of current thread to their allocators
+	iot_modelsignal_pool::flush();
+	iot_notify_inputsupdate_pool::flush();
+	iot_threadmsg_pool::flush();
+}
+
+static void drain_objpools(iot_memallocator* allocator) { //releases objects returned to typed pools of allocator after exit of its thread
+	iot_modelsignal_pool::drain(allocator);
+	iot_notify_inputsupdate_pool::drain(allocator);
+	iot_threadmsg_pool::drain(allocator);
+}
+
+int iot_parse_cpulist(const char* str, uint64_t &mask) {
+	uint64_t m=0;
+	const char* p=str;
+	while(*p) {
+		char* end;
+		unsigned long from=strtoul(p, &end, 10), to;
+		if(end==p) return IOT_ERROR_INVALID_ARGS;
+		p=end;
+		if(*p=='-') {
+			p++;
+			to=strtoul(p, &end, 10);
+			if(end==p) return IOT_ERROR_INVALID_ARGS;
+			p=end;
+		} else to=from;
+		if(from>to || to>=IOT_THREAD_MAXCPUS) return IOT_ERROR_INVALID_ARGS;
+		for(unsigned long i=from;i<=to;i++) m|=uint64_t(1)<<i;
+		if(*p==',') p++;
+			else if(*p) return IOT_ERROR_INVALID_ARGS;
+	}
+	mask=m;
 	return 0;
-onerr:
-	deinit();
-	return IOT_ERROR_NO_MEMORY;
+}
+
+void iot_thread_item_t::set_cpu_placement(void) {
+	assert(uv_thread_self()==thread);
+#ifdef __linux__
+	uint64_t mask;
+	if(this==main_thread_item) mask=thread_setup.main_cpus;
+	else if(is_realtime && thread_setup.rt_cpus) mask=thread_setup.rt_cpus;
+	else mask=thread_setup.num_worker_cpus ? thread_setup.worker_cpus[(thread_id-1)%thread_setup.num_worker_cpus] : 0;
+
+	int err;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(mask) {
+		for(unsigned i=0;i<IOT_THREAD_MAXCPUS;i++) if(mask & (uint64_t(1)<<i)) CPU_SET(i, &set);
+	} else if(this!=main_thread_item && thread_setup.main_cpus) { //worker must not inherit affinity of pinned main thread
+		long n=sysconf(_SC_NPROCESSORS_CONF);
+		for(long i=0;i<n && i<CPU_SETSIZE;i++) CPU_SET(i, &set);
+	}
+	if(CPU_COUNT(&set)>0) {
+		err=pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if(err) outlog_notice("Cannot set CPU affinity of thread %u: %s", thread_id, strerror(err));
+	}
+	if(is_realtime) {
+		struct sched_param param={};
+		param.sched_priority=thread_setup.rt_priority;
+		err=pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if(err) outlog_notice("Cannot set real-time priority %u for thread %u: %s", unsigned(thread_setup.rt_priority), thread_id, strerror(err));
+	}
+#endif
 }
 
 void iot_thread_item_t::thread_func(void) {
 	thread=uv_thread_self();
+	set_current();
+	set_cpu_placement();
 	allocator->set_thread(thread);
-	for(unsigned i=0;i<sizeof(atimer_pool)/sizeof(atimer_pool[0]);i++) atimer_pool[i].timer.set_thread(thread);
+	timerwheel.set_thread(thread);
+	start_memtrim();
 
 	uv_run(loop, UV_RUN_DEFAULT);
 
 	//TERMINATION
 
 	//process all messages currently in msg queue
-	iot_thread_registry_t::on_thread_msg(&msgq_watcher);
+	iot_thread_registry_t::process_thread_msgs(this, false);
+	flush_objpools();
+	iot_memallocator::flush_remote_releases();
 
 	//send msg to main thread
 	iot_threadmsg_t* msg=&termmsg;
@@ -106,18 +254,100 @@ void iot_thread_item_t::thread_func(void) {
 	} else {
 		main_thread_item->send_msg(msg);
 	}
+	set_current(true);
+}
+
+
+void iot_thread_item_t::start_memtrim(void) {
+	assert(uv_thread_self()==thread);
+	if(!memtrim_interval) return;
+	uv_timer_start(&memtrim_watcher, [](uv_timer_t *w)->void {
+		iot_thread_item_t* thitem=(iot_thread_item_t*)w->data;
+		uint32_t n=thitem->allocator->trim();
+		if(n>0) outlog_debug("Thread %u returned %u memory chunks to OS", thitem->thread_id, n);
+	}, uint64_t(memtrim_interval)*1000, uint64_t(memtrim_interval)*1000);
+}
+
+bool iot_thread_item_t::defer_to(iot_thread_item_t* dest, const bpretry_t &retry) {
+	assert(uv_thread_self()==thread);
+	for(uint32_t i=0;i<num_bpretries;i++) { //same action can be already deferred, so it is just coalesced
+		const bpretry_t &r=bpretry[i];
+		if(r.type!=retry.type) continue;
+		if(retry.type==bpretry_t::RETRY_NODE_OUTPUTS ? r.miid==retry.miid : r.connident==retry.connident) {
+			dest->backpressure_count.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	if(num_bpretries>=IOT_BACKPRESSURE_MAXRETRIES) return false;
+	dest->backpressure_count.fetch_add(1, std::memory_order_relaxed);
+	bpretry[num_bpretries++]=retry;
+	if(!uv_is_active((uv_handle_t*)&bpretry_watcher)) uv_timer_start(&bpretry_watcher, on_bpretry, IOT_BACKPRESSURE_RETRY_DELAY, 0);
+	return true;
 }
 
+void iot_thread_item_t::on_bpretry(uv_timer_t* w) { //static
+	iot_thread_item_t* thitem=(iot_thread_item_t*)w->data;
+	assert(uv_thread_self()==thitem->thread);
+
+	//take current list, actions which are still blocked will be deferred again by producers
+	uint32_t num=thitem->num_bpretries;
+	bpretry_t retries[IOT_BACKPRESSURE_MAXRETRIES];
+	for(uint32_t i=0;i<num;i++) retries[i]=thitem->bpretry[i];
+	thitem->num_bpretries=0;
+
+	iot_threadmsg_batch batch;
+	for(uint32_t i=0;i<num;i++) thitem->retry_deferred(retries[i]);
+}
+
+void iot_thread_item_t::retry_deferred(const bpretry_t &r) {
+	assert(uv_thread_self()==thread);
+	iot_modinstance_locker modinstlk;
+	iot_modinstance_item_t* modinst; //instance whose thread must make retry
+	iot_device_connection_t *conn=NULL;
+	if(r.type==bpretry_t::RETRY_NODE_OUTPUTS) {
+		modinstlk=modules_registry->get_modinstance(r.miid);
+		if(!modinstlk) return; //instance was stopped
+		modinst=modinstlk.modinst;
+	} else {
+		conn=iot_find_device_conn(r.connident);
+		if(!conn || conn->state<iot_device_connection_t::IOT_DEVCONN_READYDRV) return; //connection was closed
+		if(r.type==bpretry_t::RETRY_C2D_READY) {
+			if(conn->client_host!=iot_current_hostid) return;
+			modinst=conn->client.local.modinstlk.modinst;
+		} else {
+			if(conn->driver_host!=iot_current_hostid) return;
+			modinst=conn->driver.local.modinstlk.modinst;
+		}
+	}
+	if(modinst->thread!=this) { //instance was migrated after action was deferred, so its new thread must retry
+		iot_threadmsg_t* msg=NULL;
+		int err=iot_prepare_msg(msg, IOT_MSG_BACKPRESSURE_RETRY, modinst, 0, (void*)&r, sizeof(r), IOT_THREADMSG_DATAMEM_TEMP_NOALLOC, true);
+		if(err) {
+			assert(false);
+			return;
+		}
+		modinst->thread->send_msg(msg);
+		return;
+	}
+	if(r.type==bpretry_t::RETRY_NODE_OUTPUTS) {
+		if(modinst->type!=IOT_MODINSTTYPE_NODE || !modinst->is_working()) return;
+		iot_nodemodel* model=modinst->data.node.model;
+		if(model) model->flush_deferred_outputs();
+	} else if(r.type==bpretry_t::RETRY_C2D_READY) conn->c2d_ready();
+		else conn->d2c_ready();
+}
 
 void iot_thread_item_t::deinit(void) {
 	assert(uv_thread_self()==main_thread);
 	assert(this==main_thread_item || !thread); //non-main thread must be already stopped and destroyed
 	if(loop) {
-		for(unsigned i=0;i<sizeof(atimer_pool)/sizeof(atimer_pool[0]);i++) {
-			atimer_pool[i].timer.deinit();
-		}
+		timerwheel.deinit();
 		uv_close((uv_handle_t*)&msgq_watcher, NULL);
+		uv_close((uv_handle_t*)&memtrim_watcher, NULL);
+		uv_close((uv_handle_t*)&remotefree_watcher, NULL);
+		uv_close((uv_handle_t*)&bpretry_watcher, NULL);
 	}
+	num_bpretries=0;
 	if(this!=main_thread_item) {
 		if(loop) {
 			uv_walk(loop, [](uv_handle_t* handle, void* arg) -> void {if(!uv_is_closing(handle)) {uv_close(handle, NULL);}}, NULL);
@@ -136,6 +366,14 @@ void iot_thread_item_t::deinit(void) {
 //			allocator=NULL;
 		}
 	}
+	if(msgstats) {
+		free(msgstats);
+		msgstats=NULL;
+	}
+	if(jobstats) {
+		free(jobstats);
+		jobstats=NULL;
+	}
 }
 
 iot_thread_registry_t::iot_thread_registry_t(void) {
@@ -161,15 +399,13 @@ void iot_thread_registry_t::remove_modinstance(iot_modinstance_item_t* inst_item
 		inst_item->thread=NULL;
 		assert(thread_item!=NULL);
 
-		uint8_t cpu_loadtp=inst_item->cpu_loading;
-		if(cpu_loadtp>=IOT_THREAD_LOADING_NUM) cpu_loadtp=0;
-		assert(thread_item->cpu_loading >= iot_thread_loading[cpu_loadtp]);
-		thread_item->cpu_loading-=iot_thread_loading[cpu_loadtp];
+		assert(thread_item->cpu_loading >= inst_item->cpu_load);
+		thread_item->cpu_loading-=inst_item->cpu_load;
 		BILINKLIST_REMOVE(inst_item, next_inthread, prev_inthread);
 
 		if(inst_item->state==IOT_MODINSTSTATE_HUNG) BILINKLIST_INSERTHEAD(inst_item, thread_item->hung_instances_head, next_inthread, prev_inthread);
 
-		if(is_shutdown && !thread_item->instances_head) on_thread_modinstances_ended(thread_item);
+		if(is_shutdown && !thread_item->instances_head && !thread_item->migrations_in) on_thread_modinstances_ended(thread_item);
 	}
 
 void iot_thread_registry_t::add_modinstance(iot_modinstance_item_t* inst_item, iot_thread_item_t* thread_item) {
@@ -182,40 +418,167 @@ void iot_thread_registry_t::add_modinstance(iot_modinstance_item_t* inst_item, i
 
 		uint8_t cpu_loadtp=inst_item->cpu_loading;
 		if(cpu_loadtp>=IOT_THREAD_LOADING_NUM) cpu_loadtp=0;
-		thread_item->cpu_loading+=iot_thread_loading[cpu_loadtp];
+		if(!inst_item->cpu_load || cpu_loadtp==IOT_THREAD_LOADING_NUM-1) inst_item->cpu_load=iot_thread_loading[cpu_loadtp]; //measured load is kept when instance
+																												//is added again. exclusive instances always reserve whole thread
+		thread_item->cpu_loading+=inst_item->cpu_load;
+		thread_item->is_draining=false; //thread is used again (happens when all threads are draining)
+		thread_item->idle_since=0;
+		inst_item->placed_time=uv_now(main_loop);
 		BILINKLIST_INSERTHEAD(inst_item, thread_item->instances_head, next_inthread, prev_inthread);
 	}
 
-iot_thread_item_t* iot_thread_registry_t::assign_thread(uint8_t cpu_loadtp){
+int iot_thread_registry_t::migrate_modinstance(iot_modinstance_item_t* inst_item, iot_thread_item_t* thread_item) {
 		assert(uv_thread_self()==main_thread);
+		assert(inst_item!=NULL && thread_item!=NULL);
+
+		iot_thread_item_t* from=inst_item->thread;
+		//instances of main thread can work in simple sync mode and thus are never moved
+		if(!inst_item->is_migratable || !from || from==thread_item || from==main_thread_item || thread_item==main_thread_item || from->is_realtime!=thread_item->is_realtime)
+			return IOT_ERROR_INVALID_ARGS;
+		if(is_shutdown || thread_item->is_shutdown || inst_item->migrate_from || inst_item->state!=IOT_MODINSTSTATE_STARTED || inst_item->target_state!=IOT_MODINSTSTATE_STARTED)
+			return IOT_ERROR_NOT_READY;
+
+		iot_threadmsg_t* msg=NULL;
+		int err=iot_prepare_msg(msg, IOT_MSG_MIGRATE_MODINSTANCE, inst_item, 0, thread_item, 0, IOT_THREADMSG_DATAMEM_STATIC, true, &main_allocator);
+		if(err) return err;
+
+		inst_item->migrate_from=from;
+		thread_item->migrations_in++;
+		from->send_msg(msg);
+		return 0;
+	}
 
-		if(cpu_loadtp>=IOT_THREAD_LOADING_NUM) cpu_loadtp=0;
+void iot_thread_registry_t::on_modinstance_migrated(iot_modinstance_item_t* inst_item, iot_thread_item_t* thread_item, int err) {
+		assert(uv_thread_self()==main_thread);
+		assert(thread_item->migrations_in>0);
+		thread_item->migrations_in--;
+
+		if(inst_item && inst_item->migrate_from) {
+			iot_thread_item_t* from=inst_item->migrate_from;
+			inst_item->migrate_from=NULL;
+			if(!err) { //instance now works in thread_item, so move it to list of new thread
+				assert(from->cpu_loading >= inst_item->cpu_load);
+				from->cpu_loading-=inst_item->cpu_load;
+				BILINKLIST_REMOVE(inst_item, next_inthread, prev_inthread);
+				thread_item->cpu_loading+=inst_item->cpu_load;
+				inst_item->placed_time=uv_now(main_loop);
+				BILINKLIST_INSERTHEAD(inst_item, thread_item->instances_head, next_inthread, prev_inthread);
+				outlog_debug("%s instance %u of module '%s::%s' migrated from thread %u to thread %u", iot_modinsttype_name[inst_item->type], unsigned(inst_item->get_miid().iid),
+					inst_item->module->dbitem->bundle->name, inst_item->module->dbitem->module_name, from->thread_id, thread_item->thread_id);
+
+				if(is_shutdown && !from->instances_head && !from->migrations_in) on_thread_modinstances_ended(from);
+			} else {
+				outlog_debug("Migration of %s instance %u to thread %u cancelled: %s", iot_modinsttype_name[inst_item->type], unsigned(inst_item->get_miid().iid),
+					thread_item->thread_id, kapi_strerror(err));
+			}
+		}
+		if(is_shutdown && !thread_item->is_shutdown && !thread_item->instances_head && !thread_item->migrations_in) on_thread_modinstances_ended(thread_item);
+	}
 
-		//find thread with minimum loading
-		iot_thread_item_t* minthread=NULL;
-		uint16_t minload=IOT_THREAD_LOADING_MAX;
-		iot_thread_item_t* it=threads_head;
-		while(it) {
-			if(!minthread || it->cpu_loading<minload) {minload=it->cpu_loading;minthread=it;}
-			it=it->next;
+void iot_thread_registry_t::rebalance(void) {
+		assert(uv_thread_self()==main_thread);
+		if(!rebalance_interval || is_shutdown) return;
+		uint64_t now=uv_now(main_loop);
+		if(rebalance_time && now-rebalance_time<uint64_t(rebalance_interval)*1000) return;
+		bool can_restart=!restart_time || now-restart_time>=uint64_t(IOT_REBALANCE_RESTARTPERIOD)*1000;
+
+		//threads with exclusive instances are not balanced
+		auto is_balanced=[](iot_thread_item_t* th) -> bool {
+			if(th==main_thread_item || th->is_shutdown || th->is_draining) return false;
+			for(iot_modinstance_item_t* modinst=th->instances_head; modinst; modinst=modinst->next_inthread)
+				if(modinst->cpu_loading>=IOT_THREAD_LOADING_NUM-1) return false;
+			return true;
+		};
+		//find least loaded working threads separately for usual and real-time threads
+		iot_thread_item_t *minth[2]={};
+		iot_thread_item_t* th;
+		for(th=threads_head; th; th=th->next) {
+			if(!is_balanced(th)) continue;
+			int k=th->is_realtime ? 1 : 0;
+			if(!minth[k] || th->cpu_loading<minth[k]->cpu_loading) minth[k]=th;
 		}
-		assert(minthread!=NULL); //at least main thread must be here
 
-		if(cpu_loadtp<3) {
+		//select instance from most loaded thread among those exceeding least loaded one by IOT_REBALANCE_THRESHOLD which has suitable instance, so that
+		//thread with unmovable instances only does not block balancing of other threads. in thread instance with load closest to half of difference is
+		//taken, so that moving it decreases imbalance most. migratable instances are preferred over drivers which can be moved by restart only (new
+		//instance for the same device is created by device registry in least loaded thread), such restarts are done not often than IOT_REBALANCE_RESTARTPERIOD
+		iot_modinstance_item_t* best=NULL;
+		iot_thread_item_t* bestth=NULL;
+		uint16_t bestdiff=0, bestdist=0;
+		for(th=threads_head; th; th=th->next) {
+			if(!is_balanced(th)) continue;
+			uint16_t diff=th->cpu_loading-minth[th->is_realtime ? 1 : 0]->cpu_loading;
+			if(diff<IOT_REBALANCE_THRESHOLD) continue;
+			for(iot_modinstance_item_t* modinst=th->instances_head; modinst; modinst=modinst->next_inthread) {
+				if(modinst->migrate_from || modinst->state!=IOT_MODINSTSTATE_STARTED || modinst->target_state!=IOT_MODINSTSTATE_STARTED) continue;
+				if(!modinst->is_migratable && (modinst->type!=IOT_MODINSTTYPE_DRIVER || !can_restart)) continue;
+				if(now-modinst->placed_time<uint64_t(IOT_REBALANCE_MINAGE)*1000 || modinst->cpu_load>=diff) continue; //too young or moving would not decrease imbalance
+				uint16_t dist=uint16_t(modinst->cpu_load>diff/2 ? modinst->cpu_load-diff/2 : diff/2-modinst->cpu_load);
+				if(best && (best->is_migratable>modinst->is_migratable ||
+					(best->is_migratable==modinst->is_migratable && (bestdiff>diff || (bestdiff==diff && bestdist<=dist))))) continue;
+				best=modinst;
+				bestth=th;
+				bestdiff=diff;
+				bestdist=dist;
+			}
+		}
+		if(!best) return;
+
+		rebalance_time=now;
+		auto dbitem=best->module->dbitem;
+		if(best->is_migratable) {
+			int err=migrate_modinstance(best, minth[bestth->is_realtime ? 1 : 0]);
+			if(err) outlog_notice("Cannot migrate %s instance %u of module '%s::%s' from thread %u: %s", iot_modinsttype_name[best->type], unsigned(best->get_miid().iid),
+				dbitem->bundle->name, dbitem->module_name, bestth->thread_id, kapi_strerror(err));
+		} else {
+			restart_time=now;
+			outlog_notice("Restarting %s instance %u of module '%s::%s' to move it from overloaded thread %u", iot_modinsttype_name[best->type], unsigned(best->get_miid().iid),
+				dbitem->bundle->name, dbitem->module_name, bestth->thread_id);
+			best->stop(false);
+		}
+	}
+
+iot_thread_item_t* iot_thread_registry_t::assign_thread(uint8_t cpu_loadtp, bool realtime){
+		assert(uv_thread_self()==main_thread);
+
+		if(cpu_loadtp>=IOT_THREAD_LOADING_NUM) cpu_loadtp=0;
+		if(!thread_setup.rt_priority) realtime=false;
+
+		//find thread with minimum loading among threads of requested kind (real-time threads are used for latency-critical instances only)
+		iot_thread_item_t* minthread=NULL, *anythread=NULL;
+		uint16_t minload=IOT_THREAD_LOADING_MAX, anyload=IOT_THREAD_LOADING_MAX;
+		for(iot_thread_item_t* it=threads_head; it; it=it->next) {
+			if(it->is_shutdown || it->is_draining) continue; //stopping threads and threads being drained by reclaim_threads() are not used
+			if(!anythread || it->cpu_loading<anyload) {anyload=it->cpu_loading;anythread=it;}
+			if(it->is_realtime==realtime && (!minthread || it->cpu_loading<minload)) {minload=it->cpu_loading;minthread=it;}
+		}
+		if(!anythread) anythread=main_thread_item; //main thread can be marked as shut down only during shutdown
+		assert(anythread!=NULL); //at least main thread must be here
+
+		if(minthread && cpu_loadtp<3) {
 			if(minload+iot_thread_loading[cpu_loadtp]<=IOT_THREAD_LOADING_MAX) return minthread;
 		}
+		if(!minthread) minthread=anythread;
 		if(num_threads>=max_threads) {
 			outlog_notice("Limit on number of threads should be raised! Per-thread load exceeded.");
 			return minthread;
 		}
-		//here new thread must and can be started
-		//TODO
-		iot_thread_item_t* thitem=new iot_thread_item_t;
-		if(!thitem) goto onerr;
-		if(thitem->init()) goto onerr;
+		//here new thread must and can be started. item of thread stopped by reclaim_threads() is reused if there is one
+		iot_thread_item_t* thitem;
+		for(thitem=delthreads_head; thitem; thitem=thitem->next) if(thitem->is_reclaimed && thitem->loop) break;
+		if(thitem) {
+			if(thitem->restart(realtime)) goto onerr;
+			BILINKLIST_REMOVE_NOCL(thitem, next, prev);
+			outlog_debug("Stopped thread %u restarted as %sthread", thitem->thread_id, realtime ? "real-time " : "");
+		} else {
+			thitem=new iot_thread_item_t;
+			if(!thitem) goto onerr;
+			thitem->is_realtime=realtime;
+			if(thitem->init()) goto onerr;
+			outlog_debug("New %sthread created with ID %u", realtime ? "real-time " : "", thitem->thread_id);
+		}
 		BILINKLIST_INSERTHEAD(thitem, threads_head, next, prev);
 		num_threads++;
-		outlog_debug("New thread created with ID %u", thitem->thread_id);
 		return thitem;
 
 onerr:
@@ -223,9 +586,145 @@ onerr:
 		return minthread;
 	}
 
+static uint64_t iot_thread_cputime(uv_thread_t th) { //returns CPU time of thread in nanoseconds or zero on error
+		clockid_t cid;
+		struct timespec ts;
+		if(pthread_getcpuclockid(th, &cid) || clock_gettime(cid, &ts)) return 0;
+		return uint64_t(ts.tv_sec)*1000000000u+uint64_t(ts.tv_nsec);
+	}
+
+void iot_thread_registry_t::update_cpu_loads(void) {
+		assert(uv_thread_self()==main_thread);
+		uint64_t now=uv_hrtime();
+		uint64_t elapsed=cpuacct_time ? now-cpuacct_time : 0;
+		cpuacct_time=now;
+
+		iot_thread_item_t* th=threads_head;
+		while(th) {
+			if(th->is_shutdown) {th=th->next; continue;}
+			uint64_t thtime=iot_thread_cputime(th->thread);
+			uint64_t thdelta=thtime>th->cpu_time_seen ? thtime-th->cpu_time_seen : 0;
+			th->cpu_time_seen=thtime;
+
+			//sum measured time of message handlers and weights of instances by declared loading
+			uint64_t handled=0, weights=0;
+			iot_modinstance_item_t* modinst;
+			for(modinst=th->instances_head; modinst; modinst=modinst->next_inthread) {
+				handled+=modinst->cpu_time.load(std::memory_order_relaxed)-modinst->cpu_time_seen;
+				weights+=iot_thread_loading[modinst->cpu_loading<IOT_THREAD_LOADING_NUM ? modinst->cpu_loading : 0];
+			}
+			//thread time outside message handlers (libuv callbacks of instances) is shared between instances proportionally to declared loading.
+			//in main thread such time belongs to kernel itself
+			uint64_t unattributed=elapsed && th!=main_thread_item && thdelta>handled ? thdelta-handled : 0;
+
+			uint32_t sum=th==main_thread_item ? IOT_THREAD_LOADING_MAIN : 0;
+			for(modinst=th->instances_head; modinst; modinst=modinst->next_inthread) {
+				uint8_t cpu_loadtp=modinst->cpu_loading<IOT_THREAD_LOADING_NUM ? modinst->cpu_loading : 0;
+				uint64_t t=modinst->cpu_time.load(std::memory_order_relaxed);
+				uint64_t delta=t-modinst->cpu_time_seen;
+				modinst->cpu_time_seen=t;
+				if(unattributed && weights) delta+=unattributed*iot_thread_loading[cpu_loadtp]/weights;
+				modinst->cpu_total+=delta;
+
+				if(elapsed && cpu_loadtp<IOT_THREAD_LOADING_NUM-1) { //exclusive instances keep their reservation of whole thread
+					int32_t sample=int32_t(delta>=elapsed ? IOT_THREAD_LOADING_MAX : delta*IOT_THREAD_LOADING_MAX/elapsed);
+					int32_t load=int32_t(modinst->cpu_load)+(sample-int32_t(modinst->cpu_load))/IOT_CPUACCT_DECAY;
+					modinst->cpu_load=uint16_t(load>0 ? load : 1);
+				}
+				sum+=modinst->cpu_load;
+			}
+			th->cpu_loading=uint16_t(sum<UINT16_MAX ? sum : UINT16_MAX);
+			th=th->next;
+		}
+		if(elapsed) rebalance();
+	}
+
+void iot_thread_registry_t::dump_cpustats(void) { //outputs CPU usage of threads and module instances to log
+		assert(uv_thread_self()==main_thread);
+		iot_thread_item_t* th=threads_head;
+		while(th) {
+			outlog_info("Thread %u: CPU time %.3fs, estimated load %u of %u", th->thread_id, double(th->cpu_time_seen)/1e9, unsigned(th->cpu_loading), IOT_THREAD_LOADING_MAX);
+			for(iot_modinstance_item_t* modinst=th->instances_head; modinst; modinst=modinst->next_inthread) {
+				auto dbitem=modinst->module->dbitem;
+				outlog_info("  %s instance %u of module '%s::%s': CPU time %.3fs, load %u (declared %u)", iot_modinsttype_name[modinst->type], unsigned(modinst->get_miid().iid),
+					dbitem->bundle->name, dbitem->module_name, double(modinst->cpu_total)/1e9, unsigned(modinst->cpu_load), unsigned(modinst->cpu_loading));
+			}
+			th=th->next;
+		}
+	}
+
+void iot_thread_registry_t::dump_memstats(void) { //outputs statistics of memory allocators of all threads to log
+		assert(uv_thread_self()==main_thread);
+		iot_memstats_t st;
+		iot_thread_item_t* th=threads_head;
+		while(th) {
+			th->allocator->get_stats(&st);
+			outlog_info("Memory allocator of thread %u: %d blocks in use, %u OS chunks held, %" PRIu64 " bytes carved into freelists, arena %" PRIu64 " of %" PRIu64 " bytes used",
+				th->thread_id, int(st.totalinfly), unsigned(st.memchunks), st.chunkbytes, st.arenaused, st.arenabytes);
+			for(int i=0;i<IOT_MEMSTATS_NUMLISTS;i++) {
+				const iot_memstats_list_t &l=st.lists[i];
+				if(!l.allocs && !l.chunks) continue;
+				outlog_info("  list %d (size %u): allocs=%" PRIu64 " hits=%" PRIu64 " misses=%" PRIu64 " releases=%" PRIu64 " remote=%" PRIu64 " infly=%" PRIu64
+					" chunks=%u free=%" PRIu64 " (%" PRIu64 " bytes)", i, unsigned(l.objsize), l.allocs, l.hits, l.misses, l.releases, l.remote_releases,
+					l.infly, unsigned(l.chunks), l.freeblocks, l.freebytes);
+			}
+			th=th->next;
+		}
+	}
+
+void iot_thread_registry_t::dump_msgstats(void) { //outputs message latency statistics of all threads to log
+		assert(uv_thread_self()==main_thread);
+		iot_thread_item_t* th=threads_head;
+		while(th) {
+			uint64_t bpcount=th->backpressure_count.load(std::memory_order_relaxed);
+			if(bpcount>0) outlog_info("Thread %u queue depth control=%u data=%u, backpressure activated %" PRIu64 " times", th->thread_id,
+				th->msgq_depth[IOT_THREADMSG_LANE_CONTROL].load(std::memory_order_relaxed), th->msgq_depth[IOT_THREADMSG_LANE_DATA].load(std::memory_order_relaxed), bpcount);
+			const iot_thread_item_t::msgstats_t* stats=th->msgstats;
+			if(stats) {
+				outlog_info("Message latency of thread %u (in microseconds):", th->thread_id);
+				for(int i=0;i<IOT_MSG_NUMCODES;i++) {
+					const iot_latency_histogram &w=stats[i].wait, &h=stats[i].handler;
+					if(!w.total) continue;
+					outlog_info("  %s: count=%" PRIu64 " wait p50=%u p99=%u max=%u, handler p50=%u p99=%u max=%u", iot_msg_code_name(iot_msg_code_t(i)), w.total,
+						w.percentile(50), w.percentile(99), w.maxval, h.percentile(50), h.percentile(99), h.maxval);
+				}
+			}
+			const iot_thread_item_t::jobstats_t* jobstats=th->jobstats;
+			if(jobstats && jobstats->wait.total) {
+				const iot_latency_histogram &w=jobstats->wait, &r=jobstats->run;
+				outlog_info("Blocking jobs of thread %u (in microseconds): count=%" PRIu64 " wait p50=%u p99=%u max=%u, run p50=%u p99=%u max=%u", th->thread_id, w.total,
+					w.percentile(50), w.percentile(99), w.maxval, r.percentile(50), r.percentile(99), r.maxval);
+			}
+			th=th->next;
+		}
+		for(int i=0;i<IOT_SPINSITE_NUM;i++) {
+			const iot_spinsite_stats_t &st=iot_spinstats[i];
+			uint64_t contended=st.contended.load(std::memory_order_relaxed);
+			if(!contended) continue;
+			outlog_info("Spin contention in %s: waits=%" PRIu64 " pauses=%" PRIu64 " yields=%" PRIu64 " parks=%" PRIu64, iot_spinsite_name(iot_spinsite_t(i)),
+				contended, st.pauses.load(std::memory_order_relaxed), st.yields.load(std::memory_order_relaxed), st.parks.load(std::memory_order_relaxed));
+		}
+	}
+
+void iot_thread_registry_t::report_memblocks(void) { //requests all threads to log memory blocks in use by their allocators
+		assert(uv_thread_self()==main_thread);
+		iot_thread_item_t* th=threads_head;
+		while(th) {
+			if(th==main_thread_item) th->allocator->report_inflight();
+			else if(!th->is_shutdown) {
+				iot_threadmsg_t* msg=NULL;
+				int err=iot_prepare_msg(msg, IOT_MSG_THREAD_MEMREPORT, NULL, 0, NULL, 0, IOT_THREADMSG_DATAMEM_STATIC, true, &main_allocator);
+				if(err) outlog_error("Cannot request memory report from thread %u: %s", th->thread_id, kapi_strerror(err));
+					else th->send_msg(msg);
+			}
+			th=th->next;
+		}
+	}
+
 void iot_thread_registry_t::graceful_shutdown(void) { //initiate graceful shutdown, stop all module instances in all threads
 		assert(!is_shutdown);
 		is_shutdown=true;
+		iot_threadmsg_batch batch; //stop requests are delivered to every thread at once
 		iot_thread_item_t* th=threads_head;
 		while(th) {
 			iot_modinstance_item_t* modinst, *nextmodinst=th->instances_head;
@@ -236,7 +735,8 @@ void iot_thread_registry_t::graceful_shutdown(void) { //initiate graceful shutdo
 	
 					modinst->stop(false);
 				}
-			} else { //no started modinstances
+			} else if(!th->migrations_in && !th->is_shutdown) { //no started modinstances and none is being moved here. thread can be already stopping
+																	//by reclaim_threads()
 				on_thread_modinstances_ended(th);
 			}
 			th=th->next;
@@ -246,21 +746,119 @@ void iot_thread_registry_t::on_thread_modinstances_ended(iot_thread_item_t* thre
 		assert(uv_thread_self()==main_thread);
 		assert(is_shutdown);
 		if(thread!=main_thread_item) {
-			assert(!thread->is_shutdown);
-			//send msg to exit
-			iot_threadmsg_t* msg=&thread->termmsg;
-			int err=iot_prepare_msg(msg, IOT_MSG_THREAD_SHUTDOWN, NULL, 0, NULL, 0, IOT_THREADMSG_DATAMEM_STATIC, true);
-			if(err) {
-				assert(false);
-			} else {
-				thread->send_msg(msg);
-				thread->is_shutdown=true;
-			}
+			shutdown_thread(thread);
 		} else {
 			on_thread_shutdown(main_thread_item);
 		}
 	}
 
+void iot_thread_registry_t::shutdown_thread(iot_thread_item_t* thread, bool reclaim) {
+		assert(uv_thread_self()==main_thread);
+		assert(thread!=main_thread_item && !thread->is_shutdown);
+		assert(!thread->instances_head && !thread->migrations_in);
+		//send msg to exit
+		iot_threadmsg_t* msg=&thread->termmsg;
+		int err=iot_prepare_msg(msg, IOT_MSG_THREAD_SHUTDOWN, NULL, 0, NULL, 0, IOT_THREADMSG_DATAMEM_STATIC, true);
+		if(err) {
+			assert(false);
+		} else {
+			thread->send_msg(msg);
+			thread->is_reclaimed=reclaim;
+			thread->is_shutdown.store(true, std::memory_order_release);
+		}
+	}
+
+void iot_thread_registry_t::reclaim_threads(void) {
+		assert(uv_thread_self()==main_thread);
+		if(!thread_idle_timeout || is_shutdown) return;
+		forward_stopped_msgs();
+		uint64_t now=uv_now(main_loop);
+
+		//stop threads which are idle for long enough or were drained. threads with hung instances are kept as their code can still use thread loop
+		iot_thread_item_t *th, *nextth, *draining=NULL;
+		for(th=threads_head; th; th=nextth) {
+			nextth=th->next;
+			if(th==main_thread_item || th->is_shutdown) continue;
+			if(th->instances_head || th->hung_instances_head || th->migrations_in) {
+				th->idle_since=0;
+				if(th->is_draining) draining=th;
+				continue;
+			}
+			if(!th->idle_since) th->idle_since=now;
+			if(!th->is_draining && now-th->idle_since<uint64_t(thread_idle_timeout)*1000) continue;
+			outlog_debug("Stopping %s thread %u", th->is_draining ? "drained" : "idle", th->thread_id);
+			shutdown_thread(th, true);
+		}
+		if(!cpuacct_interval) return; //absorbing requires measured loading
+
+		if(!draining) {
+			//find least loaded thread whose instances can all be migrated
+			for(th=threads_head; th; th=th->next) {
+				if(th==main_thread_item || th->is_shutdown || !th->instances_head || th->hung_instances_head || th->migrations_in) continue;
+				if(draining && draining->cpu_loading<=th->cpu_loading) continue;
+				iot_modinstance_item_t* modinst;
+				for(modinst=th->instances_head; modinst; modinst=modinst->next_inthread)
+					if(!modinst->is_migratable || modinst->cpu_loading>=IOT_THREAD_LOADING_NUM-1 || modinst->state!=IOT_MODINSTSTATE_STARTED ||
+						now-modinst->placed_time<uint64_t(IOT_REBALANCE_MINAGE)*1000) break;
+				if(!modinst) draining=th;
+			}
+			if(!draining) return;
+		}
+
+		//find most loaded thread which can absorb whole loading of drained thread, so that idle threads are not filled again. retried on every call,
+		//so instances whose migration was cancelled are moved later
+		iot_thread_item_t* target=NULL;
+		for(th=threads_head; th; th=th->next) {
+			if(th==main_thread_item || th==draining || th->is_shutdown || th->is_draining || th->is_realtime!=draining->is_realtime) continue;
+			if(th->cpu_loading+draining->cpu_loading>IOT_THREAD_ABSORB_LOAD) continue;
+			if(!target || th->cpu_loading>target->cpu_loading) target=th;
+		}
+		if(!target) {
+			if(draining->is_draining) outlog_debug("Draining of thread %u cancelled", draining->thread_id);
+			draining->is_draining=false;
+			return;
+		}
+		if(!draining->is_draining) outlog_debug("Draining thread %u into thread %u", draining->thread_id, target->thread_id);
+		draining->is_draining=true;
+		for(iot_modinstance_item_t* modinst=draining->instances_head; modinst; modinst=modinst->next_inthread) {
+			if(modinst->migrate_from) continue;
+			int err=migrate_modinstance(modinst, target);
+			if(err) outlog_debug("Cannot migrate %s instance %u from drained thread %u: %s", iot_modinsttype_name[modinst->type], unsigned(modinst->get_miid().iid),
+				draining->thread_id, kapi_strerror(err));
+		}
+	}
+
+void iot_thread_registry_t::forward_stopped_msgs(void) {
+		assert(uv_thread_self()==main_thread);
+		//stopped threads are joined, so main thread is the only consumer of their queues. main thread resends messages to current threads of their instances
+		uint32_t quota[IOT_THREADMSG_NUMLANES];
+		iot_threadmsg_t* msg;
+		for(iot_thread_item_t* th=delthreads_head; th; th=th->next) {
+			if(!th->is_reclaimed) continue;
+			for(unsigned lane=0;lane<IOT_THREADMSG_NUMLANES;lane++) quota[lane]=UINT32_MAX;
+			while((msg=th->pop_msg(quota))) main_thread_item->send_msg(msg);
+		}
+	}
+
+void iot_thread_registry_t::free_stopped_threads(void) {
+		assert(uv_thread_self()==main_thread);
+		assert(!threads_head); //no thread can send messages anymore
+		iot_thread_item_t *th, *nextth;
+		for(th=delthreads_head; th; th=nextth) {
+			nextth=th->next;
+			if(th==main_thread_item || th->hung_instances_head) continue; //hung instances keep pointer to their thread
+			if(th->loop) th->deinit(); //reclaimed threads keep their loop till here
+			if(th->allocator) {
+				drain_objpools(th->allocator);
+				if(th->allocator->is_unused()) delete th->allocator;
+					else outlog_debug("Allocator of stopped thread %u still has blocks in use and is kept", th->thread_id);
+				th->allocator=NULL;
+			}
+			BILINKLIST_REMOVE(th, next, prev);
+			delete th;
+		}
+	}
+
 //notification from non-main thread about termination
 void iot_thread_registry_t::on_thread_shutdown(iot_thread_item_t* thread) {
 	assert(uv_thread_self()==main_thread);
@@ -271,19 +869,30 @@ void iot_thread_registry_t::on_thread_shutdown(iot_thread_item_t* thread) {
 		int err=uv_thread_join(&thread->thread);
 		assert(err==0);
 		thread->thread=0;
-
-		thread->deinit();
+		//ID of exited thread can be reused by new thread, so allocator must not consider it as owner anymore
+		if(thread->allocator) thread->allocator->set_thread(main_thread);
 
 		assert(num_threads>0);
 		num_threads--;
 	}
 	BILINKLIST_REMOVE_NOCL(thread, next, prev);
-	BILINKLIST_INSERTHEAD(thread, delthreads_head, next, prev); //TODO dealloc closed threads later if necesary
+	BILINKLIST_INSERTHEAD(thread, delthreads_head, next, prev);
+	if(thread->is_reclaimed && !is_shutdown) { //producers can still hold pointer to item, so its loop and queue are kept till restart() or free_stopped_threads()
+		uint32_t n=thread->allocator->trim();
+		if(n>0) outlog_debug("Allocator of stopped thread %u returned %u memory chunks to OS", thread->thread_id, n);
+		return;
+	}
+	if(thread!=main_thread_item) thread->deinit(); //items of threads stopped during shutdown are kept till free_stopped_threads()
 
 	if(!threads_head) { //main thread is the last one
 		//process all messages currently in msg queue
+		iot_threadmsg_batch::flush_current(); //this function is called during message processing, so messages collected so far must get to queues
+		forward_stopped_msgs();
 		main_thread_item->is_shutdown=true;
-		on_thread_msg(&main_thread_item->msgq_watcher);
+		process_thread_msgs(main_thread_item, false);
+		flush_objpools();
+		iot_memallocator::flush_remote_releases();
+		free_stopped_threads();
 
 		main_thread_item->deinit();
 		modules_registry->graceful_shutdown();
@@ -291,15 +900,86 @@ void iot_thread_registry_t::on_thread_shutdown(iot_thread_item_t* thread) {
 }
 
 
+//measures processing time of message and records it together with time of waiting in queue to message statistics of thread
+class iot_msgstats_recorder {
+	iot_latency_histogram* handler=NULL;
+	uint64_t start=0;
+public:
+	iot_msgstats_recorder(iot_thread_item_t* thread_item, const iot_threadmsg_t* msg) {
+		if(!msgstats_interval || msg->code>=IOT_MSG_NUMCODES) return;
+		if(!thread_item->msgstats) {
+			thread_item->msgstats=(iot_thread_item_t::msgstats_t*)calloc(IOT_MSG_NUMCODES, sizeof(iot_thread_item_t::msgstats_t));
+			if(!thread_item->msgstats) return;
+		}
+		iot_thread_item_t::msgstats_t &st=thread_item->msgstats[msg->code];
+		start=uv_hrtime();
+		st.wait.record(uint32_t(start/1000)-msg->enqueue_time);
+		handler=&st.handler;
+	}
+	~iot_msgstats_recorder(void) {
+		if(handler) handler->record(uint32_t((uv_hrtime()-start)/1000));
+	}
+};
+
+//resends message destined to code of instance to current thread of instance if instance was migrated after message had been sent.
+//returns true if message was forwarded (msg is nullified then)
+static inline bool iot_forward_msg(iot_thread_item_t* thread_item, iot_modinstance_item_t* modinst, iot_threadmsg_t* &msg) {
+	iot_thread_item_t* th=modinst ? modinst->thread : NULL;
+	if(!th || th==thread_item) return false;
+	th->send_msg(msg);
+	msg=NULL;
+	return true;
+}
+
+//measures thread CPU time from previous mark till destruction and adds it to cpu_time of module instance whose code was executed by message handler.
+//marks of consecutive messages are chained, so clock is read once per message. CLOCK_THREAD_CPUTIME_ID is not served by vDSO, so every read is
+//a syscall, which is why measurement is disabled unless cpuacct_interval is set
+class iot_cpuacct_recorder {
+	uint64_t &mark;
+public:
+	iot_modinstance_item_t* modinst; //can be changed by handler when instance is known after message decoding
+
+	static uint64_t now(void) {
+		struct timespec ts;
+		if(!cpuacct_interval || clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) return 0;
+		return uint64_t(ts.tv_sec)*1000000000u+uint64_t(ts.tv_nsec);
+	}
+	iot_cpuacct_recorder(uint64_t &mark_, iot_thread_item_t* thread_item, iot_modinstance_item_t* modinst_) : mark(mark_) {
+		modinst=modinst_ && modinst_->thread==thread_item ? modinst_ : NULL; //processing of instance messages in main thread is kernel work
+	}
+	~iot_cpuacct_recorder(void) {
+		if(!mark) return;
+		uint64_t t=now();
+		if(modinst && t>mark) modinst->cpu_time.fetch_add(t-mark, std::memory_order_relaxed);
+		mark=t;
+	}
+};
+
 void iot_thread_registry_t::on_thread_msg(uv_async_t* handle) { //static
-		iot_thread_item_t* thread_item=(iot_thread_item_t*)(handle->data);
-		iot_threadmsg_t* msg, *nextmsg=thread_item->msgq.pop_all();
+		process_thread_msgs((iot_thread_item_t*)(handle->data), true);
+	}
+
+void iot_thread_registry_t::process_thread_msgs(iot_thread_item_t* thread_item, bool bounded) { //static
+		iot_threadmsg_batch batch; //messages sent during processing (input notifications, connection ready messages etc) are delivered at exit
+		uint32_t quota[IOT_THREADMSG_NUMLANES]; //how many messages can still be processed from every lane
+		static_assert(IOT_THREADMSG_NUMLANES==2, "quota initialization must be updated");
+		quota[IOT_THREADMSG_LANE_CONTROL]=bounded ? IOT_THREADMSG_QUANTUM_CONTROL : UINT32_MAX;
+		quota[IOT_THREADMSG_LANE_DATA]=bounded ? IOT_THREADMSG_QUANTUM_DATA : UINT32_MAX;
+		iot_threadmsg_t* msg;
 		bool had_modelsignals=false; //flag that some modelling signals were sent to config registry and thus commit_signals() must be called
-		while(nextmsg) {
-			msg=nextmsg;
-			nextmsg=(nextmsg->next).load(std::memory_order_relaxed);
-			iot_modinstance_locker modinstlk=modules_registry->get_modinstance(msg->miid);
+		iot_modinstance_locker modinstlk; //lock of destination instance. is kept while consecutive messages go to the same instance to avoid
+											//relocking. must be destroyed before batch as unlock can send message
+		uint64_t cpumark=iot_cpuacct_recorder::now(); //thread CPU time at the end of previous message
+		while((msg=thread_item->pop_msg(quota))) { //control messages are taken first, so flood of data messages cannot delay them
+			iot_msgstats_recorder statsrec(thread_item, msg);
+			if(modinstlk && (!(modinstlk.modinst->get_miid()==msg->miid) || modinstlk.modinst->is_pendfree())) modinstlk.unlock();
+			if(!modinstlk) modinstlk=modules_registry->get_modinstance(msg->miid);
 			iot_modinstance_item_t* modinst=modinstlk.modinst;
+			iot_cpuacct_recorder cpurec(cpumark, thread_item, modinst);
+			if(!msg->is_kernel || msg->code==IOT_MSG_START_MODINSTANCE || msg->code==IOT_MSG_STOP_MODINSTANCE || msg->code==IOT_MSG_MIGRATE_MODINSTANCE ||
+				msg->code==IOT_MSG_CONNECTION_CLOSECL || msg->code==IOT_MSG_CONNECTION_CLOSEDRV || msg->code==IOT_MSG_BACKPRESSURE_RETRY) { //messages processed in thread of instance
+				if(iot_forward_msg(thread_item, modinst, msg)) continue;
+			}
 
 			if(msg->is_kernel) { //msg for kernel
 				switch(msg->code) {
@@ -320,6 +1000,51 @@ void iot_thread_registry_t::on_thread_msg(uv_async_t* handle) { //static
 						thread_registry->on_thread_shutdown(th);
 						break;
 					}
+					case IOT_MSG_THREAD_MEMREPORT: //request to log memory blocks in use
+						iot_release_msg(msg); msg=NULL;
+
+						thread_item->allocator->report_inflight();
+						break;
+					case IOT_MSG_MIGRATE_MODINSTANCE: { //hand over provided instance to another thread
+						//instance thread
+						iot_thread_item_t* target=(iot_thread_item_t*)msg->data;
+						int err=0;
+						if(!modinst || modinst->state!=IOT_MODINSTSTATE_STARTED || modinst->target_state!=IOT_MODINSTSTATE_STARTED || need_exit) err=IOT_ERROR_ACTION_CANCELLED;
+							else if(modinst->pending_jobs>0 || modinst->instrecheck_timer.is_on()) err=IOT_ERROR_TRY_AGAIN; //completion of blocking jobs and recheck timer are bound to loop of current thread
+						iot_release_msg(msg, true);
+						int err2=iot_prepare_msg(msg, IOT_MSG_MODINSTANCE_MIGRATED, modinst, 0, target, 0, IOT_THREADMSG_DATAMEM_STATIC, true);
+						assert(err2==0);
+						(void)err2;
+						msg->intarg=err;
+						main_thread_item->send_msg(msg);
+						msg=NULL;
+						iot_threadmsg_batch::flush_current(); //main thread must get notification before any status message caused by instance in new thread
+						if(!err) {
+							modinst->instance->thread=target->thread;
+							modinst->instance->loop=target->loop;
+							std::atomic_thread_fence(std::memory_order_release);
+							modinst->thread=target; //from now messages go to new thread. messages already queued here are forwarded
+						}
+						break;
+					}
+					case IOT_MSG_MODINSTANCE_MIGRATED: {//migration attempt of provided instance made
+						//main thread
+						assert(uv_thread_self()==main_thread);
+						iot_thread_item_t* target=(iot_thread_item_t*)msg->data;
+						int err=msg->intarg;
+						iot_release_msg(msg); msg=NULL;
+
+						thread_registry->on_modinstance_migrated(modinst, target, err);
+						break;
+					}
+					case IOT_MSG_BACKPRESSURE_RETRY: { //retry of action deferred by previous thread of instance
+						//instance thread
+						iot_thread_item_t::bpretry_t retry=*(iot_thread_item_t::bpretry_t*)msg->data;
+						iot_release_msg(msg); msg=NULL;
+
+						if(modinst) thread_item->retry_deferred(retry);
+						break;
+					}
 					case IOT_MSG_START_MODINSTANCE: //try to start provided instance (for any type of instance)
 						//instance thread
 						assert(modinst!=NULL);
@@ -378,6 +1103,7 @@ void iot_thread_registry_t::on_thread_msg(uv_async_t* handle) { //static
 						if(!conn) break; //connection was closed, no action required
 						conn->lock();
 						if(conn->connident==*(iot_connid_t*)msg->data) { //repeat check with lock
+							if(iot_forward_msg(thread_item, conn->driver.local.modinstlk.modinst, msg)) {conn->unlock(); break;}
 							if(!conn->driverstatus_msg) {iot_release_msg(msg, true); conn->driverstatus_msg=msg;}
 								else {assert(false);iot_release_msg(msg);}
 							msg=NULL;
@@ -407,6 +1133,7 @@ void iot_thread_registry_t::on_thread_msg(uv_async_t* handle) { //static
 						if(!conn) break; //connection was closed, no action required
 						conn->lock();
 						if(conn->connident==*(iot_connid_t*)msg->data) { //repeat check with lock
+							if(iot_forward_msg(thread_item, conn->client.local.modinstlk.modinst, msg)) {conn->unlock(); break;}
 							if(!conn->c2d_ready_msg) {iot_release_msg(msg, true); conn->c2d_ready_msg=msg;}
 								else {assert(false);iot_release_msg(msg);}
 							msg=NULL;
@@ -421,10 +1148,12 @@ void iot_thread_registry_t::on_thread_msg(uv_async_t* handle) { //static
 						if(!conn) break; //connection was closed, no action required
 						//state must be >= IOT_DEVCONN_READYDRV, so no lock is necessary as main thread cannot just close such connections
 //						conn->lock();
+						if(iot_forward_msg(thread_item, conn->client.local.modinstlk.modinst, msg)) break;
 
 						if(!conn->d2c_ready_msg) {iot_release_msg(msg, true); conn->d2c_ready_msg=msg; std::atomic_thread_fence(std::memory_order_release);}
 							else {assert(false);iot_release_msg(msg);}
 						msg=NULL;
+						cpurec.modinst=conn->client.local.modinstlk.modinst;
 						conn->on_d2c_ready();
 
 						break;
@@ -435,10 +1164,12 @@ void iot_thread_registry_t::on_thread_msg(uv_async_t* handle) { //static
 						if(!conn) break; //connection was closed, no action required
 						//state must be >= IOT_DEVCONN_READYDRV, so no lock is necessary as main thread cannot just close such connections
 //						conn->lock();
+						if(iot_forward_msg(thread_item, conn->driver.local.modinstlk.modinst, msg)) break;
 
 						if(!conn->c2d_ready_msg) {iot_release_msg(msg, true); conn->c2d_ready_msg=msg; std::atomic_thread_fence(std::memory_order_release);}
 							else {assert(false);iot_release_msg(msg);}
 						msg=NULL;
+						cpurec.modinst=conn->driver.local.modinstlk.modinst;
 						conn->on_c2d_ready();
 
 						break;
@@ -555,8 +1286,46 @@ outlog_debug("got unprocessed non-kernel message %u", unsigned(msg->code));
 			}
 			if(msg) iot_release_msg(msg);
 		}
+		if(modinstlk) modinstlk.unlock();
 		if(had_modelsignals) config_registry->commit_event();
+		if(!bounded || thread_item->is_shutdown) return;
+		for(unsigned lane=0;lane<IOT_THREADMSG_NUMLANES;lane++) {
+			if(quota[lane]>0) continue;
+			//quantum of lane is exhausted, so remaining messages will be processed on next loop iteration after other events
+			uv_async_send(&thread_item->msgq_watcher);
+			break;
+		}
+	}
+
+const char* iot_msg_code_name(iot_msg_code_t code) { //returns name of message code for logging
+	switch(code) {
+		case IOT_MSG_INVALID: return "INVALID";
+		case IOT_MSG_START_MODINSTANCE: return "START_MODINSTANCE";
+		case IOT_MSG_MODINSTANCE_STARTSTATUS: return "MODINSTANCE_STARTSTATUS";
+		case IOT_MSG_STOP_MODINSTANCE: return "STOP_MODINSTANCE";
+		case IOT_MSG_MODINSTANCE_STOPSTATUS: return "MODINSTANCE_STOPSTATUS";
+		case IOT_MSG_FREE_MODINSTANCE: return "FREE_MODINSTANCE";
+		case IOT_MSG_DRVOPEN_CONNECTION: return "DRVOPEN_CONNECTION";
+		case IOT_MSG_CONNECTION_DRVOPENSTATUS: return "CONNECTION_DRVOPENSTATUS";
+		case IOT_MSG_CONNECTION_DRVREADY: return "CONNECTION_DRVREADY";
+		case IOT_MSG_CONNECTION_D2C_READY: return "CONNECTION_D2C_READY";
+		case IOT_MSG_CONNECTION_C2D_READY: return "CONNECTION_C2D_READY";
+		case IOT_MSG_CLOSE_CONNECTION: return "CLOSE_CONNECTION";
+		case IOT_MSG_CONNECTION_CLOSECL: return "CONNECTION_CLOSECL";
+		case IOT_MSG_CONNECTION_CLOSEDRV: return "CONNECTION_CLOSEDRV";
+		case IOT_MSG_THREAD_SHUTDOWN: return "THREAD_SHUTDOWN";
+		case IOT_MSG_THREAD_SHUTDOWNREADY: return "THREAD_SHUTDOWNREADY";
+		case IOT_MSG_THREAD_MEMREPORT: return "THREAD_MEMREPORT";
+		case IOT_MSG_MIGRATE_MODINSTANCE: return "MIGRATE_MODINSTANCE";
+		case IOT_MSG_MODINSTANCE_MIGRATED: return "MODINSTANCE_MIGRATED";
+		case IOT_MSG_BACKPRESSURE_RETRY: return "BACKPRESSURE_RETRY";
+		case IOT_MSG_EVENTSIG_OUT: return "EVENTSIG_OUT";
+		case IOT_MSG_EVENTSIG_NOUPDATE: return "EVENTSIG_NOUPDATE";
+		case IOT_MSG_NOTIFY_INPUTSUPDATED: return "NOTIFY_INPUTSUPDATED";
+		case IOT_MSG_NUMCODES: break;
 	}
+	return "UNKNOWN";
+}
 
 //Return values:
 //0 - success
@@ -582,7 +1351,7 @@ int iot_prepare_msg(iot_threadmsg_t *&msg,iot_msg_code_t code, iot_modinstance_i
 		bool msg_alloced=false;
 		if(!msg) {
 			if(!allocator) {
-				allocator=thread_registry->find_allocator(uv_thread_self());
+				allocator=iot_thread_item_t::current_allocator;
 				assert(allocator!=NULL);
 			}
 
@@ -623,7 +1392,7 @@ int iot_prepare_msg(iot_threadmsg_t *&msg,iot_msg_code_t code, iot_modinstance_i
 					break;
 				}
 				if(!allocator) {
-					allocator=thread_registry->find_allocator(uv_thread_self());
+					allocator=iot_thread_item_t::current_allocator;
 					assert(allocator!=NULL);
 				}
 				msg->data=allocator->allocate(datasize, true);
@@ -681,14 +1450,16 @@ errexit:
 void iot_release_msg(iot_threadmsg_t *&msg, bool nofree_msgmemblock) { //nofree_msgmemblock if true, then msg struct with is_msgmemblock set is not released (only cleared)
 	if(msg->code!=IOT_MSG_INVALID) { //content is valid, so must be released
 		if(msg->data) { //data pointer can and must be cleared before calling this method to preserve data
+			bool recycled=false;
 			if(msg->is_releasable) { //object in data was saved as iot_releasable derivative, so its internal data must be released
 				iot_releasable *rel=(iot_releasable *)msg->data;
 				rel->releasedata();
+				if(msg->is_memblock) recycled=rel->recycle();
 				msg->is_releasable=0;
 			}
 			if(msg->is_memblock) {
 				assert(msg->is_malloc==0);
-				iot_release_memblock(msg->data);
+				if(!recycled) iot_release_memblock(msg->data);
 				msg->is_memblock=0;
 			} else if(msg->is_malloc) {
 				free(msg->data);
@@ -707,7 +1478,10 @@ void iot_release_msg(iot_threadmsg_t *&msg, bool nofree_msgmemblock) { //nofree_
 	}
 	if(msg->is_msgmemblock) {
 //		assert(msg->is_msginstreserv==0);
-		if(!nofree_msgmemblock) {iot_release_memblock(msg);msg=NULL;}
+		if(!nofree_msgmemblock) {
+			if(!iot_threadmsg_pool::put(msg)) iot_release_memblock(msg);
+			msg=NULL;
+		}
 		return;
 	}
 	assert(!nofree_msgmemblock); //do not allow this options to be passed for non-msgmemblock allocated structs. this can show on mistake
@@ -3,6 +3,9 @@
 #include<assert.h>
 #include<string.h>
 #include <execinfo.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <inttypes.h>
 
 #include "uv.h"
 #include "iot_module.h"
@@ -11,6 +14,166 @@
 #include "iot_daemonlib.h"
 #include "iot_kernel.h"
 
+//Per-thread cache of blocks released by current thread to allocators of other threads. Blocks are grouped by destination allocator and
+//freelist and then are returned by single push_list() to avoid contention on tail of destination freelist for every block.
+//Cached blocks are already subtracted from totalinfly of their allocator, so allocator must not be destroyed until every thread which released
+//its blocks has flushed cache (by flush_remote_releases() after each loop iteration and at thread exit). Entries with such blocks are counted by
+//iot_memallocator::remotecached, which is checked by deinit(). Only threads managed by registry use cache, as other threads (like libuv pool
+//threads) never flush it
+#define IOT_MEMALLOC_REMOTECACHE_SIZE 16
+
+struct iot_memallocator_remotecache {
+	struct {
+		iot_memallocator* allocator;
+		iot_memobject *head, *tail;
+		uint32_t listidx, count;
+	} entries[IOT_MEMALLOC_REMOTECACHE_SIZE];
+	uint32_t numentries;
+
+	void add(iot_memallocator* allocator, uint32_t listidx, iot_memobject* obj) {
+		uint32_t i;
+		for(i=0;i<numentries;i++) if(entries[i].allocator==allocator && entries[i].listidx==listidx) break;
+		if(i>=numentries) { //no entry for this allocator and freelist
+			if(numentries>=IOT_MEMALLOC_REMOTECACHE_SIZE) { //cache is full, free last entry
+				i=numentries-1;
+				flush_entry(i);
+			} else numentries++;
+			entries[i].allocator=allocator;
+			entries[i].listidx=listidx;
+			entries[i].head=entries[i].tail=NULL;
+			entries[i].count=0;
+			allocator->remotecached.fetch_add(1, std::memory_order_relaxed); //counted once per entry, not per block
+		}
+		obj->next.store(entries[i].head, std::memory_order_relaxed);
+		entries[i].head=obj;
+		if(!entries[i].tail) entries[i].tail=obj;
+		if(++entries[i].count>=iot_memallocator::remotefree_batch) {
+			flush_entry(i);
+			entries[i]=entries[numentries-1];
+			numentries--;
+		}
+	}
+	void flush_entry(uint32_t i) {
+		entries[i].allocator->freelist[entries[i].listidx].push_list(entries[i].head, entries[i].tail);
+		entries[i].allocator->remotecached.fetch_sub(1, std::memory_order_release);
+	}
+	void flush(void) {
+		for(uint32_t i=0;i<numentries;i++) flush_entry(i);
+		numentries=0;
+	}
+};
+
+static thread_local iot_memallocator_remotecache memallocator_remotecache; //zero-inited for every thread
+
+void iot_memallocator::flush_remote_releases(void) {
+	if(memallocator_remotecache.numentries>0) memallocator_remotecache.flush();
+}
+
+
+#define IOT_MEMARENA_PAGESIZE 4096
+#define IOT_MEMARENA_HUGEPAGESIZE (2*1024*1024)
+
+iot_memarena_mode_t iot_memarena::mode=IOT_MEMARENA_MALLOC;
+size_t iot_memarena::regionsize=IOT_MEMARENA_REGIONSIZE;
+
+void iot_memarena::set_mode(iot_memarena_mode_t m, size_t rsize) {
+	mode=m;
+	if(rsize<IOT_MEMARENA_HUGEPAGESIZE) rsize=IOT_MEMARENA_HUGEPAGESIZE;
+	regionsize=(rsize+IOT_MEMARENA_HUGEPAGESIZE-1) & ~size_t(IOT_MEMARENA_HUGEPAGESIZE-1);
+}
+
+void* iot_memarena::allocate(uint32_t size) {
+		if(mode==IOT_MEMARENA_MALLOC) return NULL;
+		size=(size+IOT_MEMARENA_PAGESIZE-1) & ~uint32_t(IOT_MEMARENA_PAGESIZE-1);
+		if(size>regionsize/4) return NULL; //such chunks would waste too much of region
+
+		for(uint32_t i=0;i<numfree;i++) { //look for released chunk of same size
+			if(freeextents[i].size!=size) continue;
+			char* res=freeextents[i].ptr;
+			freeextents[i]=freeextents[--numfree];
+			usedbytes+=size;
+			return res;
+		}
+		region_t* r=numregions>0 ? &regions[numregions-1] : NULL;
+		if(!r || r->used+size>regionsize) { //reserve new region
+			if(numregions>=maxregions) {
+				uint32_t newmax=maxregions+8;
+				region_t* t=(region_t*)realloc(regions, sizeof(region_t)*newmax);
+				if(!t) return NULL;
+				regions=t;
+				maxregions=newmax;
+			}
+			//reserve additional huge page to be able to align region
+			size_t mapsize=regionsize+IOT_MEMARENA_HUGEPAGESIZE;
+			char* base=(char*)mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if(base==MAP_FAILED) {
+				outlog_error("Cannot reserve %u MB of memory for allocator arena: %s", unsigned(regionsize>>20), strerror(errno));
+				return NULL;
+			}
+			char* aligned=(char*)((uintptr_t(base)+IOT_MEMARENA_HUGEPAGESIZE-1) & ~uintptr_t(IOT_MEMARENA_HUGEPAGESIZE-1));
+			if(aligned>base) munmap(base, aligned-base);
+			if(aligned+regionsize<base+mapsize) munmap(aligned+regionsize, (base+mapsize)-(aligned+regionsize));
+#ifdef MADV_HUGEPAGE
+			if(mode==IOT_MEMARENA_HUGEPAGE && madvise(aligned, regionsize, MADV_HUGEPAGE)) {
+				outlog_notice("Cannot enable huge pages for allocator arena: %s", strerror(errno));
+			}
+#endif
+			r=&regions[numregions++];
+			r->base=aligned;
+			r->used=0;
+		}
+		char* res=r->base+r->used;
+		r->used+=size;
+		usedbytes+=size;
+		return res;
+	}
+
+bool iot_memarena::owns(const void* ptr) const {
+		for(uint32_t i=0;i<numregions;i++)
+			if((const char*)ptr>=regions[i].base && (const char*)ptr<regions[i].base+regionsize) return true;
+		return false;
+	}
+
+bool iot_memarena::release(void* ptr, uint32_t size) {
+		if(!owns(ptr)) return false;
+		size=(size+IOT_MEMARENA_PAGESIZE-1) & ~uint32_t(IOT_MEMARENA_PAGESIZE-1);
+		usedbytes-=size;
+		madvise(ptr, size, MADV_DONTNEED); //return pages to OS but keep address range
+		if(numfree>=maxfree) {
+			uint32_t newmax=maxfree+64;
+			extent_t* t=(extent_t*)realloc(freeextents, sizeof(extent_t)*newmax);
+			if(!t) return true; //address range is lost until deinit()
+			freeextents=t;
+			maxfree=newmax;
+		}
+		freeextents[numfree].ptr=(char*)ptr;
+		freeextents[numfree].size=size;
+		numfree++;
+		return true;
+	}
+
+void iot_memarena::deinit(void) {
+		for(uint32_t i=0;i<numregions;i++) munmap(regions[i].base, regionsize);
+		free(regions);
+		free(freeextents);
+		regions=NULL;
+		freeextents=NULL;
+		numregions=maxregions=numfree=maxfree=0;
+		usedbytes=0;
+	}
+
+#ifndef NDEBUG
+//records allocation backtrace (skipping this function and allocating method of iot_memallocator), time and size
+static void __attribute__((noinline)) set_debuginfo(iot_memobject* obj, uint32_t size) {
+	void* tmp[5];
+	int nback,i;
+	nback=backtrace(tmp, 5);
+	for(i=0;i<3;i++) obj->backtrace[i]=i<nback-2 ? tmp[i+2] : NULL;
+	gettimeofday(&obj->alloctimeval, NULL);
+	obj->allocsize=size;
+}
+#endif
+
 iot_membuf_chain* iot_memallocator::allocate_chain(uint32_t size) { //size is length of useful data to store in chained buffer
 		assert(uv_thread_self()==thread); //only one thread can allocate
 		if(!size) return NULL;
@@ -20,6 +183,7 @@ iot_membuf_chain* iot_memallocator::allocate_chain(uint32_t size) { //size is le
 
 		iot_membuf_chain* res=NULL;
 		iot_memobject* obj;
+		stats[14].allocs+=nblocks;
 		while(nblocks>0) {
 			obj=freelist[14].pop();
 			if(!obj) break;
@@ -27,6 +191,9 @@ iot_membuf_chain* iot_memallocator::allocate_chain(uint32_t size) { //size is le
 			obj->refcount.store(1, std::memory_order_relaxed);
 			obj->listindex=14;
 			totalinfly.fetch_add(1, std::memory_order_release);
+#ifndef NDEBUG
+			set_debuginfo(obj, IOT_MEMOBJECT_CHAINSIZE-offsetof(struct iot_memobject, data));
+#endif
 
 			if(!res) {
 				res=(iot_membuf_chain*)(obj->data);
@@ -38,7 +205,10 @@ iot_membuf_chain* iot_memallocator::allocate_chain(uint32_t size) { //size is le
 		}
 		if(nblocks>0) { //no free blocks left, need to allocate additional
 			uint32_t n=nblocks;
-			if(!do_allocate_freelist(n, objsizes[14], obj, objoptblock[14])) {
+			stats[14].misses+=nblocks;
+			if(!do_allocate_freelist(n, 14, obj)) {
+				stats[14].allocs-=nblocks;
+				stats[14].misses-=nblocks;
 				if(res) release(res);
 				return NULL;
 			}
@@ -50,6 +220,9 @@ iot_membuf_chain* iot_memallocator::allocate_chain(uint32_t size) { //size is le
 				obj->refcount.store(1, std::memory_order_relaxed);
 				obj->listindex=14;
 				totalinfly.fetch_add(1, std::memory_order_release);
+#ifndef NDEBUG
+				set_debuginfo(obj, IOT_MEMOBJECT_CHAINSIZE-offsetof(struct iot_memobject, data));
+#endif
 
 				if(!res) {
 					res=(iot_membuf_chain*)(obj->data);
@@ -69,7 +242,14 @@ iot_membuf_chain* iot_memallocator::allocate_chain(uint32_t size) { //size is le
 	}
 
 iot_threadmsg_t *iot_memallocator::allocate_threadmsg(void) { //allocates threadmsg structure as memblock and inits is properly
-		iot_threadmsg_t *msg=(iot_threadmsg_t*)allocate(sizeof(iot_threadmsg_t));
+		iot_threadmsg_t *msg=iot_threadmsg_pool::get(this);
+		if(msg) { //struct was cleared by iot_release_msg(), only position in queue and destination are left
+			assert(msg->code==IOT_MSG_INVALID && msg->is_msgmemblock && !msg->data);
+			msg->set_next(NULL);
+			msg->miid.clear();
+			return msg;
+		}
+		msg=(iot_threadmsg_t*)allocate(sizeof(iot_threadmsg_t));
 		if(msg) {
 			memset(msg, 0, sizeof(*msg));
 			msg->is_msgmemblock=1;
@@ -91,69 +271,57 @@ void* iot_memallocator::allocate(uint32_t size, bool allow_direct) { //true allo
 			if(!rval) return NULL;
 			rval->memchunk=chunkidx;
 			listidx=15;
+			stats[15].allocs++;
 		} else {
-			listidx=0;
-			if(size<=160) {
-				if(size<=64) {
-					if(size>32) {
-						if(size<=48) listidx=1; //>32 <=48
-						else listidx=2; //>48  <=64
-					}
-					//else listidx=0; //<=32, inited as 0
-				}
-				else {
-					if(size<=96) {
-						if(size<=80) listidx=3; //>64 <=80
-						else listidx=4; //>80 <=96
-					}
-					else {
-						if(size<=128) listidx=5; //>96 <=128
-						else listidx=6; //>128 <=160
-					}
-				}
-			}
-			else {
-				if(size<=512) {
-					if(size<=384) {
-						if(size<=256) listidx=7; //>160 <=256
-						else listidx=8; //>256 <=384
-					}
-					else listidx=9; //>384 <=512
-				} else {
-					if(size<=2048) {
-						if(size<=1024) listidx=10; //>512 <=1024
-						else listidx=11; //>1024 <=2048
-					}
-					else {
-						if(size<=4096) listidx=12; //>2048 <=4096
-						else listidx=13; //>4096 <=IOT_MEMOBJECT_MAXPLAINSIZE+offsetof(struct iot_memobject, data) (8192)
-					}
-				}
-			}
-			rval=freelist[listidx].pop();
-			if(!rval) { //no free blocks left, need to allocate additional
+			listidx=iot_memalloc_sizeclasses_t::listindex(size);
+			auto &mag=magazines[listidx];
+			if(mag.numitems>0) rval=mag.items[--mag.numitems];
+			else if(!(rval=refill_magazine(listidx))) { //no free blocks left, need to allocate additional
 				uint32_t n=1;
-				if(!do_allocate_freelist(n, objsizes[listidx], rval, objoptblock[listidx])) return NULL;
+				if(!do_allocate_freelist(n, listidx, rval)) return NULL;
+				stats[listidx].misses++;
 				iot_memobject* rest=rval->next.load(std::memory_order_relaxed);
+				while(rest && mag.numitems<IOT_MEMALLOC_MAGAZINESIZE/2) { //fill magazine
+					mag.items[mag.numitems++]=rest;
+					rest=rest->next.load(std::memory_order_relaxed);
+				}
 				if(rest) { //put excess items to freelist
 					freelist[listidx].push_list(rest);
 				}
 			}
+			stats[listidx].allocs++;
 		}
 		rval->parent=this;
 		rval->refcount.store(1, std::memory_order_relaxed);
 		rval->listindex=listidx;
 		totalinfly.fetch_add(1, std::memory_order_release);
 #ifndef NDEBUG
-		void* tmp[4]; //we need to abandon first value. it is always inside this func
-		int nback,i;
-		nback=backtrace(tmp, 4);
-		for(i=0;i<3;i++) rval->backtrace[i]=i<nback-1 ? tmp[i+1] : NULL;
-		gettimeofday(&rval->alloctimeval, NULL);
+		set_debuginfo(rval, size-offsetof(struct iot_memobject, data));
 #endif
 		return rval->data;
 	}
 
+iot_memobject* iot_memallocator::refill_magazine(unsigned listidx) { //moves up to half of magazine capacity of blocks from freelist to magazine and returns
+																	//one more block. returns NULL if freelist is empty
+		auto &mag=magazines[listidx];
+		assert(mag.numitems==0);
+		iot_memobject* rval=freelist[listidx].pop();
+		if(!rval) return NULL;
+		iot_memobject* obj;
+		while(mag.numitems<IOT_MEMALLOC_MAGAZINESIZE/2 && (obj=freelist[listidx].pop())) mag.items[mag.numitems++]=obj;
+		return rval;
+	}
+
+void iot_memallocator::drain_magazine(unsigned listidx, uint32_t n) { //moves 'n' oldest blocks from magazine to freelist by single push_list()
+		auto &mag=magazines[listidx];
+		assert(n>0 && n<=mag.numitems);
+		for(uint32_t i=0;i<n-1;i++) mag.items[i]->next.store(mag.items[i+1], std::memory_order_relaxed);
+		mag.items[n-1]->next.store(NULL, std::memory_order_relaxed);
+		freelist[listidx].push_list(mag.items[0], mag.items[n-1]);
+		mag.numitems-=n;
+		if(mag.numitems>0) memmove(mag.items, mag.items+n, sizeof(mag.items[0])*mag.numitems);
+	}
+
 bool iot_memallocator::incref(void* ptr) { //increase object's reference count if possible (returns true). max number of refs is IOT_MEMOBJECT_MAXREF. can be called from any thread
 		iot_memobject* obj=(iot_memobject*)container_of(ptr, struct iot_memobject, data);
 		assert(obj->parent==this);
@@ -167,7 +335,7 @@ bool iot_memallocator::incref(void* ptr) { //increase object's reference count i
 	}
 
 void *iot_allocate_memblock(uint32_t size, bool allow_direct) {
-	iot_memallocator* allocator=thread_registry->find_allocator(uv_thread_self());
+	iot_memallocator* allocator=iot_thread_item_t::current_allocator; //thread-local, so works in any thread managed by registry
 	assert(allocator!=NULL);
 	if(!allocator) return NULL;
 	return allocator->allocate(size, allow_direct);
@@ -195,47 +363,240 @@ void iot_memallocator::release(void* ptr) { //decrease object's reference count.
 		assert(refcount>0);
 		if(refcount>1) return; //there are other refs
 		//refcount was 1, so became 0
-		int32_t infly=totalinfly.fetch_sub(1, std::memory_order_release);
-		assert(infly>0);
+		//totalinfly is decremented after last access to allocator, so zero totalinfly means that allocator is not used by releasing threads
+		bool is_remote=uv_thread_self()!=thread;
+		if(obj->listindex!=14) {
+			if(is_remote) stats[obj->listindex].remote_releases.fetch_add(1, std::memory_order_relaxed);
+				else stats[obj->listindex].local_releases++;
+		}
 		if(obj->listindex<14) {
-			freelist[obj->listindex].push(obj);
+			if(!is_remote) { //block stays in private cache of allocating thread
+				auto &mag=magazines[obj->listindex];
+				if(mag.numitems>=IOT_MEMALLOC_MAGAZINESIZE) drain_magazine(obj->listindex, IOT_MEMALLOC_MAGAZINESIZE/2);
+				mag.items[mag.numitems++]=obj;
+			} else if(remotefree_batch>1 && iot_current_allocator()) memallocator_remotecache.add(this, obj->listindex, obj); //thread is managed by registry
+				else freelist[obj->listindex].push(obj);
+			int32_t infly=totalinfly.fetch_sub(1, std::memory_order_release);
+			assert(infly>0);
+			(void)infly;
 			return;
 		}
 		if(obj->listindex==15) {
 			memchunks_refs[obj->memchunk]--;
 			do_free_direct(obj->memchunk);
+			int32_t infly=totalinfly.fetch_sub(1, std::memory_order_release);
+			assert(infly>0);
+			(void)infly;
 			return;
 		}
 		//obj->listindex==14
 		//ptr must point to iot_membuf_chain object
+		//all blocks of chain are returned to freelist by single push_list()
 		int n=0;
+		iot_memobject *head=obj, *tail=obj;
 		do {
 			ptr=((iot_membuf_chain*)ptr)->next;
-			freelist[14].push(obj);
 			if(!ptr) break;
 			n++;
 			obj=(iot_memobject*)container_of(ptr, struct iot_memobject, data);
 			refcount=obj->refcount.fetch_sub(1, std::memory_order_acq_rel);
 			assert(refcount==1);
+			tail->next.store(obj, std::memory_order_relaxed);
+			tail=obj;
 		} while(1);
-		if(n>0) {
-			infly=totalinfly.fetch_sub(n, std::memory_order_release);
-			assert(infly>0);
+		tail->next.store(NULL, std::memory_order_relaxed);
+		if(is_remote) stats[14].remote_releases.fetch_add(n+1, std::memory_order_relaxed);
+			else stats[14].local_releases+=n+1;
+		freelist[14].push_list(head, tail);
+		int32_t infly=totalinfly.fetch_sub(n+1, std::memory_order_release);
+		assert(infly>n);
+		(void)infly;
+	}
+
+void iot_memallocator::get_stats(iot_memstats_t* st) const { //fills statistics struct. can be called from any thread, but values are approximate if not called by allocating thread
+		memset(st, 0, sizeof(*st));
+		st->totalinfly=totalinfly.load(std::memory_order_relaxed);
+		uint32_t holes=numholes.load(std::memory_order_relaxed);
+		st->memchunks=nummemchunks>holes ? nummemchunks-holes : 0;
+		st->arenabytes=arena.get_reserved();
+		st->arenaused=arena.get_used();
+		for(int i=0;i<IOT_MEMSTATS_NUMLISTS;i++) {
+			iot_memstats_list_t &l=st->lists[i];
+			l.remote_releases=stats[i].remote_releases.load(std::memory_order_relaxed); //must be read before allocs to guarantee releases<=allocs
+			l.releases=stats[i].local_releases+l.remote_releases;
+			l.allocs=stats[i].allocs;
+			l.misses=stats[i].misses;
+			l.hits=l.allocs-l.misses;
+			l.infly=l.allocs>l.releases ? l.allocs-l.releases : 0;
+			if(i==15) { //direct allocations
+				l.objsize=0;
+				l.chunks=uint32_t(l.infly);
+				continue;
+			}
+			l.objsize=objsizes[i];
+			l.chunks=stats[i].chunks;
+			l.freeblocks=stats[i].carved>l.infly ? stats[i].carved-l.infly : 0;
+			l.freebytes=l.freeblocks*l.objsize;
+			st->chunkbytes+=stats[i].carved*l.objsize;
+		}
+	}
+
+
+//max number of allocation sites output by report_inflight()
+#define IOT_MEMALLOC_REPORT_MAXSITES 50
+
+void iot_memallocator::report_inflight(void) { //logs blocks in use grouped by allocation backtrace (in debug build) or by freelist. only allocating thread can call
+		assert(uv_thread_self()==thread); //only allocating thread can free chunks, so they cannot disappear during walking
+		iot_memstats_t st;
+		get_stats(&st);
+		outlog_info("Memory blocks in use by allocator %p: %d", (void*)this, int(st.totalinfly));
+#ifdef NDEBUG
+		for(int i=0;i<IOT_MEMSTATS_NUMLISTS;i++) {
+			if(!st.lists[i].infly) continue;
+			outlog_info("  list %d (size %u): %" PRIu64 " blocks in use", i, unsigned(st.lists[i].objsize), st.lists[i].infly);
 		}
+		outlog_info("  (allocation sites are reported in debug build only)");
+#else
+		if(st.totalinfly<=0) return;
+		struct site_t {
+			void* backtrace[3];
+			uint32_t count;
+			uint64_t bytes;
+			timeval oldest;
+		} *sites=NULL;
+		uint32_t numsites=0, maxsites=0; //sites is open addressing hash table with maxsites (power of 2) slots
+
+		for(uint32_t i=0;i<nummemchunks;i++) {
+			if(memchunks_refs[i]<=0) continue;
+			unsigned listindex=((iot_memobject*)memchunks[i])->listindex;
+			uint32_t offset=0;
+			for(int32_t j=0;j<memchunks_refs[i];j++, offset+=objsizes[listindex]) {
+				iot_memobject* obj=(iot_memobject*)((char*)memchunks[i]+offset);
+				if(obj->refcount.load(std::memory_order_relaxed)==0) continue;
+
+				if(numsites*2>=maxsites) { //grow hash table
+					uint32_t newmax=maxsites ? maxsites*2 : 256;
+					site_t* t=(site_t*)calloc(newmax, sizeof(site_t));
+					if(!t) {
+						outlog_error("No memory to build report of memory blocks");
+						free(sites);
+						return;
+					}
+					for(uint32_t k=0;k<maxsites;k++) {
+						if(!sites[k].count) continue;
+						uint32_t h=uint32_t(uintptr_t(sites[k].backtrace[0])>>4) & (newmax-1);
+						while(t[h].count) h=(h+1) & (newmax-1);
+						t[h]=sites[k];
+					}
+					free(sites);
+					sites=t;
+					maxsites=newmax;
+				}
+				uint32_t h=uint32_t(uintptr_t(obj->backtrace[0])>>4) & (maxsites-1);
+				while(sites[h].count && memcmp(sites[h].backtrace, obj->backtrace, sizeof(obj->backtrace))) h=(h+1) & (maxsites-1);
+				site_t &site=sites[h];
+				if(!site.count) {
+					memcpy(site.backtrace, obj->backtrace, sizeof(obj->backtrace));
+					site.oldest=obj->alloctimeval;
+					numsites++;
+				} else if(timercmp(&obj->alloctimeval, &site.oldest, <)) site.oldest=obj->alloctimeval;
+				site.count++;
+				site.bytes+=obj->allocsize;
+				if(listindex==15) break; //direct allocation occupies whole chunk
+			}
+		}
+		if(!sites) return;
+		//move used slots to the beginning and sort them by descending count
+		uint32_t n=0;
+		for(uint32_t k=0;k<maxsites;k++) if(sites[k].count) sites[n++]=sites[k];
+		qsort(sites, n, sizeof(site_t), [](const void* a, const void* b) -> int {
+			uint32_t ca=((const site_t*)a)->count, cb=((const site_t*)b)->count;
+			return ca>cb ? -1 : ca<cb ? 1 : 0;
+		});
+		timeval now;
+		gettimeofday(&now, NULL);
+		for(uint32_t k=0;k<n && k<IOT_MEMALLOC_REPORT_MAXSITES;k++) {
+			char **symb=backtrace_symbols(sites[k].backtrace,3);
+			outlog_info("  %u blocks, %" PRIu64 " bytes, oldest allocated %ld s ago, backtrace: %s\n\t%s\n\t%s", sites[k].count, sites[k].bytes,
+				long(now.tv_sec-sites[k].oldest.tv_sec), symb ? symb[0] : "?", symb ? symb[1] : "?", symb ? symb[2] : "?");
+			free(symb);
+		}
+		if(n>IOT_MEMALLOC_REPORT_MAXSITES) outlog_info("  ... %u more allocation sites", n-IOT_MEMALLOC_REPORT_MAXSITES);
+		free(sites);
+#endif
 	}
 
+uint32_t iot_memallocator::trim(void) { //returns to OS chunks whose blocks are all in freelist for freelists larger than their watermark. returns number of freed chunks
+		assert(uv_thread_self()==thread); //only one thread can pop from freelists
+		uint32_t *freecnt=NULL; //for each memchunk number of its blocks found in freelist. special value UINT32_MAX marks chunk to be freed
+		uint32_t numfreed=0;
+		for(unsigned idx=0;idx<15;idx++) {
+			uint64_t watermark=trim_watermark[idx] ? trim_watermark[idx] : objoptblock[idx];
+			//do quick check using statistics
+			uint64_t infly=stats[idx].allocs-stats[idx].local_releases-stats[idx].remote_releases.load(std::memory_order_relaxed);
+			if(stats[idx].carved<=infly || (stats[idx].carved-infly)*objsizes[idx]<=watermark) continue;
+
+			if(idx<14 && magazines[idx].numitems>0) drain_magazine(idx, magazines[idx].numitems); //cached blocks must be examined too
 
-void iot_memallocator::do_free_direct(uint16_t &chunkindex) {
+			if(!freecnt) {
+				freecnt=(uint32_t*)malloc(sizeof(uint32_t)*nummemchunks);
+				if(!freecnt) return numfreed;
+			}
+			memset(freecnt, 0, sizeof(uint32_t)*nummemchunks);
+
+			iot_memobject *lst=freelist[idx].pop_all(), *obj, *next;
+			if(!lst) continue;
+			uint64_t freebytes=0;
+			for(obj=lst; obj; obj=obj->next.load(std::memory_order_relaxed)) {
+				assert(obj->memchunk<nummemchunks && memchunks_refs[obj->memchunk]>0);
+				freecnt[obj->memchunk]++;
+				freebytes+=objsizes[idx];
+			}
+			//select fully free chunks to be released and build list of remaining blocks
+			iot_memobject *keephead=NULL, *keeptail=NULL;
+			for(obj=lst; obj; obj=next) {
+				next=obj->next.load(std::memory_order_relaxed);
+				uint32_t &cnt=freecnt[obj->memchunk];
+				if(cnt==uint32_t(memchunks_refs[obj->memchunk])) { //chunk is fully free and no decision was made for it yet
+					if(freebytes>watermark) {
+						freebytes-=uint64_t(cnt)*objsizes[idx];
+						cnt=UINT32_MAX;
+					} else cnt=0; //keep chunk
+				}
+				if(cnt==UINT32_MAX) continue; //block will be freed together with its chunk
+				obj->next.store(NULL, std::memory_order_relaxed);
+				if(keeptail) keeptail->next.store(obj, std::memory_order_relaxed);
+					else keephead=obj;
+				keeptail=obj;
+			}
+			if(keephead) freelist[idx].push_list(keephead);
+
+			for(uint32_t i=0;i<nummemchunks;i++) {
+				if(freecnt[i]!=UINT32_MAX) continue;
+				uint16_t chunkidx=uint16_t(i);
+				uint32_t chunksize=uint32_t(memchunks_refs[i])*objsizes[idx];
+				stats[idx].chunks--;
+				stats[idx].carved-=memchunks_refs[i];
+				memchunks_refs[i]=0;
+				do_free_direct(chunkidx, chunksize);
+				numfreed++;
+			}
+		}
+		if(freecnt) free(freecnt);
+		return numfreed;
+	}
+
+void iot_memallocator::do_free_direct(uint16_t chunkindex, uint32_t size) { //chunkindex is passed by value because caller can take it from block being freed
 		assert(chunkindex<nummemchunks);
 		assert(memchunks[chunkindex]!=NULL);
 		assert(memchunks_refs[chunkindex]==0);
-		free(memchunks[chunkindex]);
+		if(!size || !arena.release(memchunks[chunkindex], size)) free(memchunks[chunkindex]);
 		memchunks[chunkindex]=NULL;
 		memchunks_refs[chunkindex]=-2;
-		numholes.fetch_add(std::memory_order_release);
+		numholes.fetch_add(1, std::memory_order_release);
 	}
 
-void *iot_memallocator::do_allocate_direct(uint32_t size, uint16_t &chunkindex) { //allocate next chunk of memory
+void *iot_memallocator::do_allocate_direct(uint32_t size, uint16_t &chunkindex, bool use_arena) { //allocate next chunk of memory
 	//returns NULL on allocation error
 		void* res;
 		if(nummemchunks>=maxmemchunks) { //reallocate memchunks array to make it bigger
@@ -247,7 +608,8 @@ void *iot_memallocator::do_allocate_direct(uint32_t size, uint16_t &chunkindex)
 				numholes.fetch_sub(1, std::memory_order_relaxed); //decrease even if no real hole was found in release mode
 				assert(i<nummemchunks); //something wrong if numholes>0 but no holes found
 				if(i<nummemchunks) {
-					res=malloc(size);
+					res=use_arena ? arena.allocate(size) : NULL;
+					if(!res) res=malloc(size);
 					if(!res) {
 						numholes.fetch_add(1, std::memory_order_relaxed); //reverse sub
 						return NULL;
@@ -282,7 +644,8 @@ void *iot_memallocator::do_allocate_direct(uint32_t size, uint16_t &chunkindex)
 			memchunks_refs=r;
 			maxmemchunks=newmax;
 		}
-		res=malloc(size);
+		res=use_arena ? arena.allocate(size) : NULL;
+		if(!res) res=malloc(size);
 		if(!res) return NULL;
 		chunkindex=uint16_t(nummemchunks);
 		nummemchunks++;
@@ -291,19 +654,21 @@ void *iot_memallocator::do_allocate_direct(uint32_t size, uint16_t &chunkindex)
 		return res;
 	}
 
-bool iot_memallocator::do_allocate_freelist(uint32_t &n, uint32_t sz, iot_memobject * &ret, uint32_t OPTIMAL_BLOCK, uint32_t MAX_BLOCK,unsigned maxn) {
+bool iot_memallocator::do_allocate_freelist(uint32_t &n, unsigned listidx, iot_memobject * &ret, uint32_t MAX_BLOCK,unsigned maxn) {
 	//'n' - minimal amount to be allocated for success. on exit it is updated to show quantity of allocated items
-	//'sz' - size of each item
+	//'listidx' - index of freelist which determines size of each item and optimal size of OS-allocated chunk
 	//'ret' - head of allocated unidirectional list of items will be put here. if 'ret' already has pointer to unidirectional list, this list will be prepended
 	//'maxn' - optional maximum quantity of allocated items
 	//returns false if 'n' was not satisfied (but less structs can be allocated and returned with 'n' updated to show quantity of allocated)
+		assert(listidx<15);
+		uint32_t sz=objsizes[listidx];
 		uint32_t perchunk;
 		uint32_t nchunks;
 		uint32_t chunksize;
 		
 		if(n>maxn) n=maxn;
 
-		perchunk=OPTIMAL_BLOCK/sz;
+		perchunk=objoptblock[listidx]/sz;
 		if(perchunk < n) {
 			//optimal block is not enough for n items, try to take bigger chunk up to MAX_BLOCK
 			chunksize=sz*n;
@@ -325,7 +690,7 @@ bool iot_memallocator::do_allocate_freelist(uint32_t &n, uint32_t sz, iot_memobj
 		uint32_t n_good=0;
 		uint16_t chunkidx;
 		while(nchunks>0) {
-			char *t=(char*)do_allocate_direct(chunksize, chunkidx);
+			char *t=(char*)do_allocate_direct(chunksize, chunkidx, true);
 			if(!t) { //malloc failure
 				if(n_good>=n || perchunk<=1) break; //stop if minimum quantity reached or chunksize cannot be decreased
 				perchunk>>=1; //decrease chunksize to have the half of items
@@ -339,6 +704,7 @@ bool iot_memallocator::do_allocate_freelist(uint32_t &n, uint32_t sz, iot_memobj
 				((iot_memobject *)t)->memchunk=chunkidx;
 #ifndef NDEBUG
 				((iot_memobject *)t)->refcount.store(0, std::memory_order_relaxed);
+				((iot_memobject *)t)->listindex=listidx; //allows to determine freelist of chunk by its first block
 #endif
 				t+=sz;
 			}
@@ -346,12 +712,15 @@ bool iot_memallocator::do_allocate_freelist(uint32_t &n, uint32_t sz, iot_memobj
 			((iot_memobject *)t)->memchunk=chunkidx;
 #ifndef NDEBUG
 			((iot_memobject *)t)->refcount.store(0, std::memory_order_relaxed);
+			((iot_memobject *)t)->listindex=listidx; //allows to determine freelist of chunk by its first block
 #endif
 
 			memchunks_refs[chunkidx]=(int32_t)perchunk;
 			ret=first;
 			nchunks--;
 			n_good+=perchunk;
+			stats[listidx].chunks++;
+			stats[listidx].carved+=perchunk;
 			if(nchunks>0 && n_good+perchunk>maxn) { //another samesized chunk will be allocated which overflows maxn
 				assert(n_good<=maxn); //problem with some math above
 				perchunk=maxn-n_good;
@@ -370,7 +739,17 @@ bool iot_memallocator::do_allocate_freelist(uint32_t &n, uint32_t sz, iot_memobj
 
 void iot_memallocator::deinit(void) { //free all OS-allocated chunks
 		if(!memchunks) return;
-		//clear all freelists
+		assert(remotecached.load(std::memory_order_acquire)==0); //all threads must have flushed their remote caches
+		//clear all magazines and freelists
+		for(int i=0;i<14;i++) {
+			for(uint32_t j=0;j<magazines[i].numitems;j++) {
+				iot_memobject* obj=magazines[i].items[j];
+				assert(obj->refcount==0);
+				assert(memchunks_refs[obj->memchunk]>0);
+				memchunks_refs[obj->memchunk]--;
+			}
+			magazines[i].numitems=0;
+		}
 		for(int i=0;i<15;i++) {
 			iot_memobject* lst=freelist[i].pop_all();
 			while(lst) {
@@ -417,9 +796,10 @@ void iot_memallocator::deinit(void) { //free all OS-allocated chunks
 		for(uint32_t i=0;i<nummemchunks;i++) {
 			if(memchunks_refs[i]==-2) {realholes++;continue;} //a hole
 			assert(memchunks_refs[i]==0);
-			free(memchunks[i]);
+			if(!arena.owns(memchunks[i])) free(memchunks[i]);
 			memchunks[i]=NULL;
 		}
+		arena.deinit();
 		free(memchunks);
 		free(memchunks_refs);
 		memchunks=NULL;
@@ -428,43 +808,13 @@ void iot_memallocator::deinit(void) { //free all OS-allocated chunks
 		maxmemchunks=0;
 		assert(realholes==numholes.load(std::memory_order_relaxed));
 		numholes.store(0,std::memory_order_relaxed);
-printf("Allocator deinited\n");
+		outlog_debug("Allocator deinited");
 	}
 
-const uint32_t iot_memallocator::objsizes[15]={
-		32,  //index 0
-		48,
-		64,
-		80,
-		96,
-		128,
-		160,
-		256,
-		384, //index 8
-		512,
-		1024,
-		2048,
-		4096,
-		IOT_MEMOBJECT_MAXPLAINSIZE+offsetof(struct iot_memobject, data), //index 13
-		IOT_MEMOBJECT_CHAINSIZE //index 14 , underlying data for objects must be iot_membuf_chain
-	};
-const uint32_t iot_memallocator::objoptblock[15]={
-		16384,  //index 0
-		16384,
-		16384,
-		32768,
-		32768,
-		32768,
-		32768,
-		32768,
-		65536, //index 8
-		65536,
-		65536,
-		128*1024,
-		256*1024,
-		256*1024, //index 13
-		256*1024 //index 14 , underlying data for objects must be iot_membuf_chain
-	};
+constexpr const uint32_t *iot_memallocator::objsizes;
+constexpr const uint32_t *iot_memallocator::objoptblock;
+uint32_t iot_memallocator::trim_watermark[15]={};
+uint32_t iot_memallocator::remotefree_batch=IOT_MEMALLOC_REMOTEFREE_BATCH;
 
 iot_memallocator main_allocator;
 
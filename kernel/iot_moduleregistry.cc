@@ -606,11 +606,11 @@ iot_modinstance_item_t* iot_modules_registry_t::register_modinstance(iot_module_
 //		assert(waslock==false); //this is the only place to change iid from zero to nonzero, so once iot_modinstances[last_iid].miid.iid is false, it must not become true somewhere else
 
 		if(!iot_modinstances[last_iid].init(iot_miid_t(curtime, last_iid), module, type, thread, instance)) {
-//			iot_modinstances[last_iid].acclock.clear(std::memory_order_release);
+//			iot_modinstances[last_iid].acclock.unlock();
 			return NULL;
 		}
 
-//		iot_modinstances[last_iid].acclock.clear(std::memory_order_release);
+//		iot_modinstances[last_iid].acclock.unlock();
 		return &iot_modinstances[last_iid];
 	}
 	return NULL;
@@ -661,6 +661,7 @@ bool iot_modinstance_item_t::init(const iot_miid_t &miid_, iot_module_item_t* mo
 			assert(iface!=NULL);
 			BILINKLIST_INSERTHEAD(this, module->driver_instances_head, next_inmod, prev_inmod);
 			cpu_loading=iface->cpu_loading;
+			is_migratable=iface->is_migratable;
 			break;
 		}
 		case IOT_MODINSTTYPE_NODE: {
@@ -668,6 +669,7 @@ bool iot_modinstance_item_t::init(const iot_miid_t &miid_, iot_module_item_t* mo
 			assert(iface!=NULL);
 			BILINKLIST_INSERTHEAD(this, module->node_instances_head, next_inmod, prev_inmod);
 			cpu_loading=iface->cpu_loading;
+			is_migratable=iface->is_migratable;
 			for(int i=0;i<iface->num_devices;i++) data.node.dev[i].actual=1;
 			break;
 		}
@@ -688,7 +690,7 @@ void iot_modinstance_item_t::deinit(void) {
 		thread_registry->remove_modinstance(this); //remove instance from thread's list
 	}
 
-	instrecheck_timer.unschedule();
+	assert(!instrecheck_timer.is_on()); //timer is unscheduled in instance thread when stop completes
 
 	for(unsigned i=0;i<sizeof(msgp)/sizeof(msg_structs[0]);i++) {
 		if(msg_structs[i]) {
@@ -764,7 +766,6 @@ void iot_modules_registry_t::free_modinstance(iot_modinstance_item_t* modinst) {
 		//leave such instance as is, but schedule daemon restart
 
 		thread_registry->remove_modinstance(modinst); //will move to list of hang instances of thread
-		modinst->instrecheck_timer.unschedule(); //??
 
 		iot_process_module_bug(module);
 		return;
@@ -833,7 +834,7 @@ int iot_modules_registry_t::create_driver_modinstance(iot_module_item_t* module,
 	auto iface=module->config->iface_device_driver;
 	//from here all errors go to onerr
 
-	iot_thread_item_t* thread=thread_registry->assign_thread(iface->cpu_loading);
+	iot_thread_item_t* thread=thread_registry->assign_thread(iface->cpu_loading, iface->is_realtime);
 	assert(thread!=NULL);
 
 	iot_devifaces_list deviface_list;
@@ -926,7 +927,7 @@ int iot_modules_registry_t::create_node_modinstance(iot_module_item_t* module, i
 	int err;
 	auto iface=module->config->iface_node;
 	//from here all errors go to onerr
-	iot_thread_item_t* thread=thread_registry->assign_thread(iface->cpu_loading);
+	iot_thread_item_t* thread=thread_registry->assign_thread(iface->cpu_loading, iface->is_realtime);
 	assert(thread!=NULL);
 
 	err=iface->init_instance(&inst, thread->thread, nodemodel->node_id, nodemodel->cfgitem->json_config);
@@ -1421,7 +1422,7 @@ void iot_modinstance_item_t::recheck_job(bool no_jobs) {
 	if(delay<0xFFFFFFFFFFFFFFFFul) {
 		if(!no_jobs || !instrecheck_timer.is_on() || instrecheck_timer.get_timeout()>now+2000) //for no_jobs mode to not reschedule timer if its activation is close or in past
 																					//to avoid repeated moving of job execution time in case of often no_jobs calls
-			thread->schedule_atimer(instrecheck_timer, delay); //zero delay always means at least 1 sec now!!!
+			thread->schedule_atimer(instrecheck_timer, delay);
 	}
 }
 
@@ -1466,8 +1467,11 @@ int iot_modinstance_item_t::stop(bool ismsgproc, bool forcemsg) { //called in wo
 	err=instance->stop();
 	if(err==IOT_ERROR_TRY_AGAIN && state==IOT_MODINSTSTATE_STARTED) { //module asked some time to make graceful stop
 		state=IOT_MODINSTSTATE_STOPPING;
+		state_timeout=uv_now(thread->loop)+3*1000;
+		recheck_job(true); //timer is scheduled on wheel of instance thread, so it must be done here
 		goto onsucc;
 	}
+	instrecheck_timer.unschedule(); //stop is finished, so no state-related jobs remain. timer belongs to instance thread and thus cannot be unscheduled in deinit
 	if(err) {
 		state=IOT_MODINSTSTATE_HUNG;
 		outlog_error("Error stopping %s instance of module '%s::%s' with ID %u: %s. This is a bug. Module hung.", iot_modinsttype_name[type], module->dbitem->bundle->name, module->dbitem->module_name, module->dbitem->module_id, kapi_strerror(err));
@@ -1502,9 +1506,7 @@ onsucc:
 int iot_modinstance_item_t::on_stop_status(int err, bool isasync) { //processes result of modinstance stop in main thread
 	assert(uv_thread_self()==main_thread);
 
-	if(state==IOT_MODINSTSTATE_STOPPING) {
-		state_timeout=uv_now(main_loop)+3*1000;
-		recheck_job(true);
+	if(state==IOT_MODINSTSTATE_STOPPING) { //recheck timer was scheduled by stop() in instance thread
 		return IOT_ERROR_NOT_READY;
 	}
 
@@ -1566,17 +1568,12 @@ int iot_modinstance_item_t::on_stop_status(int err, bool isasync) { //processes
 }
 
 void iot_modinstance_item_t::unlock(void) { //unlocked previously locked structure. CANNOT BE called if lock() returned false
-		uint8_t c=0;
 		bool notify=false;
-		while(acclock.test_and_set(std::memory_order_acquire)) {
-			//busy wait
-			c++;
-			if((c & 0x3F)==0x3F) sched_yield();
-		}
+		acclock.lock(IOT_SPINSITE_MODINST_LOCK);
 		assert(refcount>0);
 		refcount--;
-		if(refcount==0 && pendfree) notify=true;
-		acclock.clear(std::memory_order_release);
+		if(refcount==0 && pendfree.load(std::memory_order_relaxed)) notify=true;
+		acclock.unlock();
 		if(notify) {
 			if(uv_thread_self()==main_thread) { //can call directly
 				modules_registry->free_modinstance(this);
@@ -0,0 +1,44 @@
+#include<stdint.h>
+#include<assert.h>
+#include<time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "iot_common.h"
+
+iot_spinsite_stats_t iot_spinstats[IOT_SPINSITE_NUM]={};
+
+const char* iot_spinsite_name(iot_spinsite_t site) {
+	static const char* names[IOT_SPINSITE_NUM]={
+		"mpsc_queue::pop",
+		"mpsc_queue::pop_all",
+		"iot_device_connection_t::lock",
+		"iot_modinstance_item_t::lock"
+	};
+	return site<IOT_SPINSITE_NUM ? names[site] : "unknown";
+}
+
+void iot_spin_backoff::do_park(volatile std::atomic<uint32_t>* word, uint32_t expected) {
+	struct timespec ts={0, IOT_SPIN_PARKTIMEOUT*1000};
+#ifdef __linux__
+	if(word) { //returns immediately if value already differs
+		static_assert(sizeof(std::atomic<uint32_t>)==sizeof(uint32_t), "futex requires plain 32-bit word");
+		syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT_PRIVATE, expected, &ts, NULL, 0);
+		return;
+	}
+#else
+	if(word && word->load(std::memory_order_relaxed)!=expected) return;
+#endif
+	nanosleep(&ts, NULL);
+}
+
+void iot_spin_backoff::unpark(volatile std::atomic<uint32_t>* word, uint32_t count) {
+#ifdef __linux__
+	syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#else
+	//parked threads wake up by timeout
+#endif
+}
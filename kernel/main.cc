@@ -47,6 +47,8 @@ struct daemon_setup_t {
 	bool daemonize=true;
 	int min_loglevel=-1;
 	uint16_t listen_port=12000;
+	uint32_t memstats_interval=0; //period in seconds of dumping memory allocators statistics to log. zero disables dumping
+	uint32_t cpustats_interval=0; //period in seconds of dumping CPU usage of module instances to log. zero disables dumping
 } daemon_setup;
 
 
@@ -126,6 +128,117 @@ bool parse_setup(void) {
 		if(!errno && i32>0 && i32<65536) daemon_setup.listen_port=uint16_t(i32);
 			else fprintf(stderr, "Invalid value '%s' for 'listen_port' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
 	}
+	if(json_object_object_get_ex(obj, "memstats_interval", &val)) {
+		errno=0;
+		int32_t i32=json_object_get_int(val);
+		if(!errno && i32>=0) daemon_setup.memstats_interval=uint32_t(i32);
+			else fprintf(stderr, "Invalid value '%s' for 'memstats_interval' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "msgstats_interval", &val)) {
+		errno=0;
+		int32_t i32=json_object_get_int(val);
+		if(!errno && i32>=0) msgstats_interval=uint32_t(i32);
+			else fprintf(stderr, "Invalid value '%s' for 'msgstats_interval' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "cpuacct_interval", &val)) {
+		errno=0;
+		int32_t i32=json_object_get_int(val);
+		if(!errno && i32>=0) cpuacct_interval=uint32_t(i32);
+			else fprintf(stderr, "Invalid value '%s' for 'cpuacct_interval' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "rebalance_interval", &val)) {
+		errno=0;
+		int32_t i32=json_object_get_int(val);
+		if(!errno && i32>=0) rebalance_interval=uint32_t(i32);
+			else fprintf(stderr, "Invalid value '%s' for 'rebalance_interval' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "cpustats_interval", &val)) {
+		errno=0;
+		int32_t i32=json_object_get_int(val);
+		if(!errno && i32>=0) daemon_setup.cpustats_interval=uint32_t(i32);
+			else fprintf(stderr, "Invalid value '%s' for 'cpustats_interval' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "msgq_watermark", &val)) {
+		errno=0;
+		int32_t i32=json_object_get_int(val);
+		if(!errno && i32>=0) msgq_watermark=uint32_t(i32);
+			else fprintf(stderr, "Invalid value '%s' for 'msgq_watermark' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "memtrim_interval", &val)) {
+		errno=0;
+		int32_t i32=json_object_get_int(val);
+		if(!errno && i32>=0) memtrim_interval=uint32_t(i32);
+			else fprintf(stderr, "Invalid value '%s' for 'memtrim_interval' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "memfree_batch", &val)) {
+		errno=0;
+		int32_t i32=json_object_get_int(val);
+		if(!errno && i32>0) iot_memallocator::set_remotefree_batch(uint32_t(i32));
+			else fprintf(stderr, "Invalid value '%s' for 'memfree_batch' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "memtrim_watermark", &val)) { //either single value for all freelists or array with value for each freelist
+		bool isarr=json_object_is_type(val, json_type_array);
+		int n=isarr ? json_object_array_length(val) : 15;
+		for(int i=0;i<n && i<15;i++) {
+			json_object* item=isarr ? json_object_array_get_idx(val, i) : val;
+			errno=0;
+			int32_t i32=json_object_get_int(item);
+			if(!errno && i32>=0) iot_memallocator::set_trim_watermark(i, uint32_t(i32));
+				else fprintf(stderr, "Invalid value '%s' for 'memtrim_watermark' in setup file '%s' was ignored\n",  json_object_get_string(item), namebuf);
+		}
+	}
+	if(json_object_object_get_ex(obj, "main_cpus", &val)) {
+		if(iot_parse_cpulist(json_object_get_string(val), thread_setup.main_cpus))
+			fprintf(stderr, "Invalid value '%s' for 'main_cpus' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "worker_cpus", &val)) { //either single CPU list for all workers or array with CPU list for each worker
+		bool isarr=json_object_is_type(val, json_type_array);
+		int n=isarr ? json_object_array_length(val) : 1;
+		thread_setup.num_worker_cpus=0;
+		for(int i=0;i<n && i<IOT_THREAD_MAXCPUSETS;i++) {
+			json_object* item=isarr ? json_object_array_get_idx(val, i) : val;
+			uint64_t mask;
+			if(!iot_parse_cpulist(json_object_get_string(item), mask) && mask) thread_setup.worker_cpus[thread_setup.num_worker_cpus++]=mask;
+				else if(isarr || *json_object_get_string(item)) fprintf(stderr, "Invalid value '%s' for 'worker_cpus' in setup file '%s' was ignored\n",  json_object_get_string(item), namebuf);
+		}
+	}
+	if(json_object_object_get_ex(obj, "rt_priority", &val)) {
+		errno=0;
+		int32_t i32=json_object_get_int(val);
+		if(!errno && i32>=0 && i32<=99) thread_setup.rt_priority=uint8_t(i32);
+			else fprintf(stderr, "Invalid value '%s' for 'rt_priority' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "rt_cpus", &val)) {
+		if(iot_parse_cpulist(json_object_get_string(val), thread_setup.rt_cpus))
+			fprintf(stderr, "Invalid value '%s' for 'rt_cpus' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "thread_idle_timeout", &val)) {
+		errno=0;
+		int32_t i32=json_object_get_int(val);
+		if(!errno && i32>=0) thread_idle_timeout=uint32_t(i32);
+			else fprintf(stderr, "Invalid value '%s' for 'thread_idle_timeout' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "workpool_size", &val)) {
+		errno=0;
+		int32_t i32=json_object_get_int(val);
+		if(!errno && i32>=0 && i32<=IOT_WORKPOOL_MAXSIZE) workpool_size=uint32_t(i32);
+			else fprintf(stderr, "Invalid value '%s' for 'workpool_size' in setup file '%s' was ignored\n",  json_object_get_string(val), namebuf);
+	}
+	if(json_object_object_get_ex(obj, "memarena", &val)) {
+		const char* mode=json_object_get_string(val);
+		uint32_t regionsize=IOT_MEMARENA_REGIONSIZE;
+		json_object *sizeval=NULL;
+		if(json_object_object_get_ex(obj, "memarena_size", &sizeval)) {
+			errno=0;
+			int32_t i32=json_object_get_int(sizeval);
+			if(!errno && i32>=2 && i32<=1024) regionsize=uint32_t(i32)*1024*1024;
+				else fprintf(stderr, "Invalid value '%s' for 'memarena_size' in setup file '%s' was ignored\n",  json_object_get_string(sizeval), namebuf);
+		}
+		if(!strcmp(mode, "malloc")) iot_memarena::set_mode(IOT_MEMARENA_MALLOC);
+		else if(!strcmp(mode, "mmap")) iot_memarena::set_mode(IOT_MEMARENA_MMAP, regionsize);
+		else if(!strcmp(mode, "hugepage")) iot_memarena::set_mode(IOT_MEMARENA_HUGEPAGE, regionsize);
+		else fprintf(stderr, "Invalid value '%s' for 'memarena' in setup file '%s' was ignored\n",  mode, namebuf);
+	}
 
 	json_object_put(obj); obj = NULL;
 	return true;
@@ -146,6 +259,11 @@ int main(int argn, char **arg) {
 	if(!parse_setup()) {
 		return 1;
 	}
+	if(workpool_size>0) { //libuv reads size of its thread pool from environment when first job is queued
+		char sizebuf[16];
+		snprintf(sizebuf, sizeof(sizebuf), "%u", unsigned(workpool_size));
+		setenv("UV_THREADPOOL_SIZE", sizebuf, 1);
+	}
 
 	if(min_loglevel<0) {
 		if(daemon_setup.min_loglevel>=0) min_loglevel=daemon_setup.min_loglevel;
@@ -183,6 +301,8 @@ int main(int argn, char **arg) {
 		goto onexit;
 	}
 
+	main_thread_item->set_cpu_placement(); //after daemonizing as forked process gets affinity of parent only
+
 	iot_starttime_ms=uv_now(main_loop);
 	gettimeofday(&_start_timeval, NULL);
 
@@ -231,23 +351,71 @@ int main(int argn, char **arg) {
 
 	config_registry->start_config();
 
-	uv_signal_t sigint_watcher,sighup_watcher,sigusr1_watcher,sigterm_watcher,sigquit_watcher;
+	uv_signal_t sigint_watcher,sighup_watcher,sigusr1_watcher,sigusr2_watcher,sigterm_watcher,sigquit_watcher;
 
 	uv_signal_init(main_loop, &sigint_watcher);
 	uv_signal_init(main_loop, &sighup_watcher);
 	uv_signal_init(main_loop, &sigusr1_watcher);
+	uv_signal_init(main_loop, &sigusr2_watcher);
 	uv_signal_init(main_loop, &sigterm_watcher);
 	uv_signal_init(main_loop, &sigquit_watcher);
 
 	uv_signal_start(&sigint_watcher,onsignal,SIGINT);
 	uv_signal_start(&sighup_watcher,onsignal,SIGHUP);
 	uv_signal_start(&sigusr1_watcher,onsignal,SIGUSR1);
+	uv_signal_start(&sigusr2_watcher,onsignal,SIGUSR2);
 	uv_signal_start(&sigterm_watcher,onsignal,SIGTERM);
 	uv_signal_start(&sigquit_watcher,onsignal,SIGQUIT);
 
 	uv_timer_t shutdown_watcher;
 	uv_timer_init(main_loop, &shutdown_watcher);
 
+	uv_timer_t memstats_watcher;
+	uv_timer_init(main_loop, &memstats_watcher);
+	if(daemon_setup.memstats_interval>0) {
+		uv_timer_start(&memstats_watcher,[](uv_timer_t *w)->void {
+			thread_registry->dump_memstats();
+		}, uint64_t(daemon_setup.memstats_interval)*1000, uint64_t(daemon_setup.memstats_interval)*1000);
+		uv_unref((uv_handle_t*)&memstats_watcher); //must not keep loop running during shutdown
+	}
+	main_thread_item->start_memtrim();
+
+	uv_timer_t msgstats_watcher;
+	uv_timer_init(main_loop, &msgstats_watcher);
+	if(msgstats_interval>0) {
+		uv_timer_start(&msgstats_watcher,[](uv_timer_t *w)->void {
+			thread_registry->dump_msgstats();
+		}, uint64_t(msgstats_interval)*1000, uint64_t(msgstats_interval)*1000);
+		uv_unref((uv_handle_t*)&msgstats_watcher); //must not keep loop running during shutdown
+	}
+
+	uv_timer_t cpuacct_watcher;
+	uv_timer_init(main_loop, &cpuacct_watcher);
+	if(cpuacct_interval>0) {
+		thread_registry->update_cpu_loads(); //take initial CPU times
+		uv_timer_start(&cpuacct_watcher,[](uv_timer_t *w)->void {
+			thread_registry->update_cpu_loads();
+		}, uint64_t(cpuacct_interval)*1000, uint64_t(cpuacct_interval)*1000);
+		uv_unref((uv_handle_t*)&cpuacct_watcher); //must not keep loop running during shutdown
+	}
+
+	uv_timer_t cpustats_watcher;
+	uv_timer_init(main_loop, &cpustats_watcher);
+	if(daemon_setup.cpustats_interval>0) {
+		uv_timer_start(&cpustats_watcher,[](uv_timer_t *w)->void {
+			thread_registry->dump_cpustats();
+		}, uint64_t(daemon_setup.cpustats_interval)*1000, uint64_t(daemon_setup.cpustats_interval)*1000);
+		uv_unref((uv_handle_t*)&cpustats_watcher); //must not keep loop running during shutdown
+	}
+
+	uv_timer_t threadidle_watcher;
+	uv_timer_init(main_loop, &threadidle_watcher);
+	if(thread_idle_timeout>0) {
+		uv_timer_start(&threadidle_watcher,[](uv_timer_t *w)->void {
+			thread_registry->reclaim_threads();
+		}, uint64_t(thread_idle_timeout)*1000, uint64_t(thread_idle_timeout)*1000);
+		uv_unref((uv_handle_t*)&threadidle_watcher); //must not keep loop running during shutdown
+	}
 
 //	bool shuttingdown; //true when graceful shutdown was scheduled
 //	shuttingdown=false;
@@ -266,6 +434,12 @@ int main(int argn, char **arg) {
 
 			outlog_notice("Graceful shutdown initiated");
 
+			uv_timer_stop(&memstats_watcher);
+			uv_timer_stop(&msgstats_watcher);
+			uv_timer_stop(&cpuacct_watcher);
+			uv_timer_stop(&cpustats_watcher);
+			uv_timer_stop(&threadidle_watcher);
+
 			config_registry->free_config(); //must stop evaluation of configuration
 
 			//Do graceful stop
@@ -309,6 +483,10 @@ void onsignal (uv_signal_t *w, int signum) {
 		uv_stop (main_loop);
 		return;
 	}
+	if(signum==SIGUSR2) { //log memory blocks in use (SIGUSR1 is taken by restart)
+		thread_registry->report_memblocks();
+		return;
+	}
 	if(signum==SIGTERM || signum==SIGUSR1 || signum==SIGHUP) { //terminate or restart program gracefully
 		need_exit=1;
 		if(signum==SIGUSR1) need_restart=1;
@@ -468,6 +468,8 @@ struct devcontype_linuxinput_t { //represents custom data for devices with DEVCO
 
 //period of checking for available keyboards, in milliseconds
 #define DETECTOR_POLL_INTERVAL 5000
+//allowed delay in milliseconds of device polling, so that it can be coalesced with other timers of thread
+#define DETECTOR_POLL_SLACK 1000
 //maximum event devices for detection
 #define DETECTOR_MAX_DEVS 32
 
@@ -476,17 +478,38 @@ detector* detector_obj=NULL;
 
 class detector : public iot_device_detector_base {
 	bool is_active=false; //true if instance was started
-	uv_timer_t timer_watcher={};
+	iot_atimer_item timer_watcher;
 	int devinfo_len=0; //number of filled items in devinfo array
 	struct devinfo_t { //short device info indexed by event_index field. minimal info necessary to determine change of device
 		iot_hwdev_localident_linuxinput ident;
 		bool present;
 		bool error; //there was persistent error adding this device, so no futher attempts should be done
 	} devinfo[DETECTOR_MAX_DEVS]={};
+	iot_hwdev_details_linuxinput fulldevinfo[DETECTOR_MAX_DEVS]; //result of last scan of devices. filled in kernel pool thread by get_event_devices()
+	int fulldevinfo_len=0; //number of filled items in fulldevinfo array
+	bool scan_pending=false; //true while scan of devices runs in kernel pool thread
 
 	void on_timer(void) {
-		iot_hwdev_details_linuxinput fulldevinfo[DETECTOR_MAX_DEVS];
-		int n=get_event_devices(fulldevinfo, DETECTOR_MAX_DEVS);
+		if(scan_pending) return; //previous scan is not finished yet
+		//opening and querying of device files can block, so it is done outside of instance thread
+		int err=kapi_run_blocking(
+			[](void* arg) -> void { //pool thread
+				detector* obj=static_cast<detector*>(arg);
+				obj->fulldevinfo_len=get_event_devices(obj->fulldevinfo, DETECTOR_MAX_DEVS);
+			},
+			[](void* arg, int status) -> void { //instance thread
+				detector* obj=static_cast<detector*>(arg);
+				obj->scan_pending=false;
+				if(!status) obj->on_scan_done();
+			}, this);
+		if(err) {
+			kapi_outlog_error("Cannot start scan of devices: %s", kapi_strerror(err));
+			return; //will be retried on next timer signal
+		}
+		scan_pending=true;
+	}
+	void on_scan_done(void) {
+		int n=fulldevinfo_len;
 		if(n==0 && devinfo_len==0) return; //nothing to do
 
 		iot_hwdev_localident_linuxinput ident;
@@ -560,13 +583,19 @@ class detector : public iot_device_detector_base {
 		assert(!is_active);
 		if(is_active) return 0;
 
-		uv_loop_t* loop=kapi_get_event_loop(thread);
-		assert(loop!=NULL);
-
-		uv_timer_init(loop, &timer_watcher);
-		int err=uv_timer_start(&timer_watcher, [](uv_timer_t* handle) -> void {detector_obj->on_timer();}, 0, DETECTOR_POLL_INTERVAL);
-		if(err<0) {
-			kapi_outlog_error("Cannot start timer: %s", uv_strerror(err));
+		timer_watcher.init(this, [](void* param) -> void {
+			detector* obj=static_cast<detector*>(param);
+			int err=obj->kapi_timer_start(obj->timer_watcher, DETECTOR_POLL_INTERVAL, DETECTOR_POLL_SLACK);
+			if(err) {
+				kapi_outlog_error("Cannot restart timer: %s", kapi_strerror(err));
+				obj->kapi_self_abort(IOT_ERROR_TEMPORARY_ERROR);
+				return;
+			}
+			obj->on_timer();
+		});
+		int err=kapi_timer_start(timer_watcher, 0);
+		if(err) {
+			kapi_outlog_error("Cannot start timer: %s", kapi_strerror(err));
 			return IOT_ERROR_TEMPORARY_ERROR;
 		}
 		is_active=true;
@@ -578,7 +607,7 @@ class detector : public iot_device_detector_base {
 
 		if(!is_active) return 0;
 
-		uv_close((uv_handle_t*)&timer_watcher, NULL);
+		timer_watcher.unschedule();
 		is_active=false;
 		return 0;
 	}
@@ -692,6 +721,8 @@ static iot_iface_device_detector_t detector_iface = {
 /////////////////////////////////////////////////////////////////////////////////
 //Driver for /dev/input/eventX input devices abstraction which has EV_KEY and/or EV_LED capabilities, i.e. normal keyboards or other input devices with keys
 
+//allowed delay in milliseconds of retries after device errors, so that they can be coalesced with other timers of thread
+#define DRIVER_RETRY_SLACK 1000
 
 struct input_drv_instance;
 
@@ -709,7 +740,7 @@ struct input_drv_instance : public iot_device_driver_base {
 
 	iot_toneplayer_state* toneplayer=NULL;
 	uint64_t tone_stop_after=0;
-	uv_timer_t tonetimer_watcher={};
+	uv_timer_t tonetimer_watcher={}; //plain uv timer, because tone duration must be exact and timer wheel can be late up to one tick
 	iot_toneplayer_tone_t current_tone={};
 	bool tone_playing=false; //state of ton player
 	bool tone_pending=false; //flag that current_tone must be sent to device
@@ -729,7 +760,7 @@ struct input_drv_instance : public iot_device_driver_base {
 	char device_path[32];
 	int eventfd=-1; //FD of opened /dev/input/eventX or <0 if not opened. 
 	uv_tcp_t io_watcher={}; //watcher over eventfd
-	uv_timer_t timer_watcher={}; //to count different retries
+	iot_atimer_item timer_watcher; //to count different retries
 	enum internal_error_t {
 		ERR_NONE=0,
 		ERR_OPEN_TEMP=1,
@@ -868,9 +899,7 @@ private:
 	virtual int start(void) {
 		assert(uv_thread_self()==thread);
 
-		uv_timer_init(loop, &timer_watcher);
-		timer_watcher.data=this;
-
+		timer_watcher.init(this, on_timer_static);
 		uv_timer_init(loop, &tonetimer_watcher);
 		tonetimer_watcher.data=this;
 
@@ -895,7 +924,8 @@ private:
 
 		stop_device_polling(false);
 
-		uv_close((uv_handle_t*)&timer_watcher, NULL);
+		timer_watcher.unschedule();
+		uv_close((uv_handle_t*)&tonetimer_watcher, NULL);
 		return 0;
 	}
 
@@ -1099,7 +1129,7 @@ private:
 	int setup_device_polling(void) {
 		assert(uv_thread_self()==thread);
 
-		uv_timer_stop(&timer_watcher);
+		timer_watcher.unschedule();
 		int retrytm=0; //assigned in case of temp error to set retry period
 		internal_error_t temperr=ERR_NONE; //assigned in case of temp error to set internal error
 		int err;
@@ -1220,21 +1250,27 @@ private:
 				internal_error=temperr;
 				error_count=1;
 			}
-			uv_timer_stop(&timer_watcher);
-			uv_timer_start(&timer_watcher, on_timer_static, (error_count>10 ? 10 : error_count)*retrytm*1000, 0);
+			start_timer((error_count>10 ? 10 : error_count)*retrytm*1000, DRIVER_RETRY_SLACK);
 			return;
 		}
 		//here no errors, just stopped polling and closed device
 	}
 
-	static void on_timer_static(uv_timer_t* handle) {
-		input_drv_instance* obj=static_cast<input_drv_instance*>(handle->data);
+	static void on_timer_static(void* param) {
+		input_drv_instance* obj=static_cast<input_drv_instance*>(param);
 		obj->on_timer();
 	}
 	static void on_tonetimer_static(uv_timer_t* handle) {
 		input_drv_instance* obj=static_cast<input_drv_instance*>(handle->data);
 		obj->toneplay_continue();
 	}
+	bool start_timer(uint64_t delay, uint64_t slack=0) { //starts timer_watcher. on error aborts instance, so that kernel restarts it later
+		int err=kapi_timer_start(timer_watcher, delay, slack);
+		if(!err) return true;
+		kapi_outlog_error("Cannot start timer: %s", kapi_strerror(err));
+		if(started) kapi_self_abort(IOT_ERROR_TEMPORARY_ERROR);
+		return false;
+	}
 	void on_timer(void) {
 		int err;
 		if(uv_is_active((uv_handle_t*)&io_watcher)) {
@@ -1328,8 +1364,7 @@ private:
 			internal_error=ERR_EVENT_MGR;
 			error_count=1;
 		}
-		uv_timer_stop(&timer_watcher);
-		uv_timer_start(&timer_watcher, on_timer_static, (error_count>10 ? 10 : error_count)*10*1000, 0);
+		start_timer((error_count>10 ? 10 : error_count)*10*1000, DRIVER_RETRY_SLACK);
 	}
 
 
@@ -1372,8 +1407,7 @@ private:
 			if(ev->type==EV_SYN) {
 				read_waitsyn=false;
 				resync_state=true;
-				uv_timer_stop(&timer_watcher);
-				uv_timer_start(&timer_watcher, on_timer_static, 0, 0);
+				start_timer(0);
 			}
 
 			return;
@@ -1418,8 +1452,7 @@ private:
 				if(ev->value == 1) leds_state|=(1u<<ev->code);
 					else leds_state&=~(1u<<ev->code);
 				kapi_outlog_info("LED with code %d is %s", ev->code, ev->value == 1 ? "on" : "off");
-				uv_timer_stop(&timer_watcher);
-				uv_timer_start(&timer_watcher, on_timer_static, 0, 0);
+				start_timer(0);
 				break;
 			case EV_SW: //led event
 				kapi_outlog_info("SW with code %d valued %d", ev->code, (int)ev->value);
@@ -30,7 +30,6 @@
 
 struct eventsrc_instance : public iot_node_base {
 	uint32_t node_id;
-	uv_timer_t timer_watcher={};
 	struct {
 		const iot_conn_clientview *conn;
 		uint16_t maxkeycode;
@@ -195,6 +194,7 @@ static iot_iface_node_t eventsrc_iface_node = {
 	.cpu_loading = 0,
 	.is_persistent = 1,
 	.is_sync = 0,
+	.is_migratable = 1, //keeps no handles or timers in event loop, so can be moved between threads without restart
 
 	.devcfg={
 		{
@@ -452,6 +452,7 @@ static iot_iface_node_t oper_keystate_iface_node = {
 	.cpu_loading = 0,
 	.is_persistent = 0,
 	.is_sync = 1,
+	.is_migratable = 1, //keeps no handles or timers in event loop, so can be moved between threads without restart
 
 	.devcfg={},
 	.valueoutput={
@@ -673,6 +674,7 @@ static iot_iface_node_t leds_iface_node = {
 	.cpu_loading = 0,
 	.is_persistent = 1,
 	.is_sync = 0,
+	.is_migratable = 1, //keeps no handles or timers in event loop, so can be moved between threads without restart
 
 	.devcfg={
 		{
@@ -229,6 +229,7 @@ static iot_iface_node_t basic_iface_node = {
 	.cpu_loading = 0,
 	.is_persistent = 1,
 	.is_sync = 0,
+	.is_migratable = 1, //keeps no handles or timers in event loop, so can be moved between threads without restart
 
 	.devcfg={
 		{
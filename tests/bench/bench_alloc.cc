@@ -0,0 +1,166 @@
+//Allocator microbenchmarks. Compares iot_memallocator with glibc malloc() and C++ operator new for:
+// - single-thread allocate/release throughput for every size class (blocks are allocated in groups of 'depth' and released in LIFO order).
+//   small depth is served by per-thread magazines, large one goes through freelists
+// - producer/consumer pattern where blocks are released by thread other than allocating one
+// - allocation of chained buffers by allocate_chain() of different total sizes
+//Every result is output as JSON object on separate line (see bench_report()).
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_common.h"
+
+#define BENCH_ALLOC_MAXDEPTH 256 //max number of blocks kept allocated simultaneously in single-thread tests
+
+enum bench_alloc_impl_t {
+	BENCH_IMPL_IOT,
+	BENCH_IMPL_MALLOC,
+	BENCH_IMPL_NEW
+};
+static const char* impl_names[]={"iot", "malloc", "new"};
+
+static volatile uint8_t sink; //prevents compiler from eliminating allocations
+
+static inline void* impl_alloc(bench_alloc_impl_t impl, iot_memallocator* allocator, uint32_t size) {
+	void* ptr;
+	switch(impl) {
+		case BENCH_IMPL_IOT: ptr=allocator->allocate(size); break;
+		case BENCH_IMPL_MALLOC: ptr=malloc(size); break;
+		default: ptr=::operator new(size); break;
+	}
+	if(!ptr) {
+		fprintf(stderr, "Allocation of %u bytes failed\n", unsigned(size));
+		exit(1);
+	}
+	*(uint8_t*)ptr=uint8_t(size);
+	return ptr;
+}
+
+static inline void impl_free(bench_alloc_impl_t impl, void* ptr) {
+	sink+=*(uint8_t*)ptr;
+	switch(impl) {
+		case BENCH_IMPL_IOT: iot_release_memblock(ptr); break;
+		case BENCH_IMPL_MALLOC: free(ptr); break;
+		default: ::operator delete(ptr); break;
+	}
+}
+
+static void run_sizeclass(bench_alloc_impl_t impl, unsigned listidx, uint32_t size, uint32_t depth, uint32_t count) {
+	iot_memallocator allocator;
+	allocator.set_thread(uv_thread_self());
+	void* ptrs[BENCH_ALLOC_MAXDEPTH];
+	assert(depth>0 && depth<=BENCH_ALLOC_MAXDEPTH);
+	uint32_t rounds=(count+depth-1)/depth;
+
+	for(unsigned i=0;i<depth;i++) ptrs[i]=impl_alloc(impl, &allocator, size); //warm up
+	for(unsigned i=depth;i>0;i--) impl_free(impl, ptrs[i-1]);
+
+	uint64_t start=uv_hrtime();
+	for(uint32_t r=0;r<rounds;r++) {
+		for(unsigned i=0;i<depth;i++) ptrs[i]=impl_alloc(impl, &allocator, size);
+		for(unsigned i=depth;i>0;i--) impl_free(impl, ptrs[i-1]);
+	}
+	uint64_t end=uv_hrtime();
+	uint64_t ops=uint64_t(rounds)*depth;
+	bench_report("alloc_sizeclass", "\"impl\":\"%s\",\"listidx\":%u,\"size\":%u,\"depth\":%u,\"count\":%" PRIu64 ",\"ns_per_op\":%.1f",
+		impl_names[impl], listidx, size, depth, ops, bench_ns_per_op(start, end, ops));
+}
+
+struct crossthread_params {
+	bench_alloc_impl_t impl;
+	iot_memallocator* allocator;
+	bench_ptr_channel* chan;
+	uint32_t size, count, iteration;
+};
+
+static void producer_func(void* arg) {
+	crossthread_params* p=(crossthread_params*)arg;
+	p->allocator->set_thread(uv_thread_self());
+	for(uint32_t i=0;i<p->count;i++) p->chan->send(impl_alloc(p->impl, p->allocator, p->size));
+}
+
+static void consumer_func(void* arg) {
+	crossthread_params* p=(crossthread_params*)arg;
+	for(uint32_t i=0;i<p->count;i++) {
+		impl_free(p->impl, p->chan->recv());
+		if(p->impl==BENCH_IMPL_IOT && (i+1) % p->iteration==0) iot_memallocator::flush_remote_releases();
+	}
+	if(p->impl==BENCH_IMPL_IOT) iot_memallocator::flush_remote_releases();
+}
+
+static void run_crossthread(bench_alloc_impl_t impl, uint32_t size, uint32_t count) {
+	iot_memallocator allocator;
+	bench_ptr_channel* chan=new bench_ptr_channel;
+	crossthread_params p={impl, &allocator, chan, size, count, 256};
+
+	uv_thread_t prod, cons;
+	uint64_t start=uv_hrtime();
+	uv_thread_create(&cons, consumer_func, &p);
+	uv_thread_create(&prod, producer_func, &p);
+	uv_thread_join(&prod);
+	uv_thread_join(&cons);
+	uint64_t end=uv_hrtime();
+
+	bench_report("alloc_crossthread", "\"impl\":\"%s\",\"size\":%u,\"count\":%u,\"ns_per_op\":%.1f",
+		impl_names[impl], size, count, bench_ns_per_op(start, end, count));
+
+	allocator.set_thread(uv_thread_self());
+	delete chan;
+}
+
+static void run_chain(bench_alloc_impl_t impl, uint32_t size, uint32_t count) {
+	iot_memallocator allocator;
+	allocator.set_thread(uv_thread_self());
+	unsigned segments=0;
+	if(impl==BENCH_IMPL_IOT) {
+		iot_membuf_chain* chain=allocator.allocate_chain(size);
+		if(!chain) {
+			fprintf(stderr, "Allocation of chain of %u bytes failed\n", unsigned(size));
+			exit(1);
+		}
+		segments=chain->count_children()+1;
+		iot_release_memblock(chain);
+	}
+
+	uint64_t start=uv_hrtime();
+	for(uint32_t i=0;i<count;i++) {
+		if(impl==BENCH_IMPL_IOT) {
+			iot_membuf_chain* chain=allocator.allocate_chain(size);
+			if(!chain) {
+				fprintf(stderr, "Allocation of chain of %u bytes failed\n", unsigned(size));
+				exit(1);
+			}
+			chain->buf[0]=char(i);
+			sink+=uint8_t(chain->buf[0]);
+			iot_release_memblock(chain);
+		} else {
+			impl_free(impl, impl_alloc(impl, &allocator, size));
+		}
+	}
+	uint64_t end=uv_hrtime();
+	bench_report("alloc_chain", "\"impl\":\"%s\",\"size\":%u,\"segments\":%u,\"count\":%u,\"ns_per_op\":%.1f",
+		impl_names[impl], size, segments, count, bench_ns_per_op(start, end, count));
+}
+
+int main(int argc, char** argv) {
+	uint32_t count=argc>1 ? uint32_t(atoi(argv[1])) : 2000000;
+	if(!count) count=2000000;
+	static const bench_alloc_impl_t impls[]={BENCH_IMPL_IOT, BENCH_IMPL_MALLOC, BENCH_IMPL_NEW};
+	const unsigned numimpls=sizeof(impls)/sizeof(impls[0]);
+
+	static const uint32_t depths[]={8, BENCH_ALLOC_MAXDEPTH};
+	for(unsigned d=0;d<sizeof(depths)/sizeof(depths[0]);d++)
+		for(unsigned l=0;l<iot_memalloc_sizeclasses_t::numplain;l++) {
+			uint32_t size=iot_memalloc_sizeclasses_t::objsizes[l]-offsetof(struct iot_memobject, data); //largest useful size for freelist
+			for(unsigned i=0;i<numimpls;i++) run_sizeclass(impls[i], l, size, depths[d], count);
+		}
+
+	static const uint32_t crosssizes[]={32, 256, 2048};
+	for(unsigned s=0;s<sizeof(crosssizes)/sizeof(crosssizes[0]);s++)
+		for(unsigned i=0;i<numimpls;i++) run_crossthread(impls[i], crosssizes[s], count);
+
+	static const uint32_t chainsizes[]={1024, 16*1024, 64*1024, 256*1024, 1024*1024};
+	for(unsigned s=0;s<sizeof(chainsizes)/sizeof(chainsizes[0]);s++)
+		for(unsigned i=0;i<numimpls;i++) run_chain(impls[i], chainsizes[s], count/(chainsizes[s]/1024)/8+1);
+	return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+//Helpers shared by standalone benchmarks
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <sched.h>
+
+#include "uv.h"
+#include "iot_module.h"
+#include "iot_kernel.h"
+
+
+//SPSC channel of pointers between two benchmark threads built over byte_fifo_buf
+class bench_ptr_channel {
+	byte_fifo_buf fifo;
+	char buf[1<<16];
+public:
+	bench_ptr_channel(void) {
+		fifo.setbuf(16, buf);
+	}
+	void send(void* ptr) { //spins while channel is full
+		while(fifo.write(&ptr, sizeof(ptr))==0) sched_yield();
+	}
+	void* recv(void) { //spins while channel is empty
+		void* ptr;
+		while(fifo.read(&ptr, sizeof(ptr))==0) sched_yield();
+		return ptr;
+	}
+};
+
+//one step of busy-wait in benchmark loop. spins with pause instruction and periodically yields CPU, so benchmarks also work
+//when there are less CPU cores than benchmark threads. 'iter' must be zeroed before wait loop
+static inline void bench_spin(uint32_t &iter) {
+	if(++iter & 0x7F) iot_cpu_relax();
+		else sched_yield();
+}
+
+//outputs one benchmark result as JSON object on separate line. 'fmt' must contain comma-separated "key":value pairs
+static inline void bench_report(const char* bench, const char* fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	printf("{\"bench\":\"%s\",", bench);
+	vprintf(fmt, ap);
+	printf("}\n");
+	va_end(ap);
+	fflush(stdout);
+}
+
+static inline double bench_ns_per_op(uint64_t start_ns, uint64_t end_ns, uint64_t ops) {
+	return ops ? double(end_ns-start_ns)/double(ops) : 0.0;
+}
+
+#endif //BENCH_COMMON_H
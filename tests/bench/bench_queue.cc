@@ -0,0 +1,222 @@
+//Benchmarks of lock-free primitives from iot_common.h:
+// - mpsc_queue with 1..N producer threads and single consumer which takes items by pop() or pop_all(). Every item carries send timestamp,
+//   so besides throughput the latency between push and pop is measured. FIFO order of items of every producer is verified
+// - single-thread push+pop cost of mpsc_queue (no contention)
+// - byte_fifo_buf SPSC bandwidth and per-message latency for different message and buffer sizes
+//Latency percentiles are in nanoseconds and are upper estimations from iot_latency_histogram.
+//Every result is output as JSON object on separate line (see bench_report()).
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_common.h"
+
+#define BENCH_QUEUE_MAXPRODUCERS 16
+//maximum size of message written to byte_fifo_buf
+#define BENCH_FIFO_MAXMSGSIZE 4096
+
+struct bench_qnode {
+	volatile std::atomic<bench_qnode*> next;
+	uint64_t sent; //uv_hrtime() at push
+	uint32_t producer, seq;
+};
+typedef mpsc_queue<bench_qnode, bench_qnode, &bench_qnode::next> bench_queue_t;
+
+static volatile std::atomic<uint32_t> start_flag; //producers wait for non-zero value to start simultaneously
+
+static void report_latency(const char* bench, const char* params, const iot_latency_histogram& h, uint64_t ops, uint64_t start, uint64_t end) {
+	bench_report(bench, "%s,\"count\":%" PRIu64 ",\"ns_per_op\":%.1f,\"mops\":%.2f,\"lat_p50\":%u,\"lat_p90\":%u,\"lat_p99\":%u,\"lat_p999\":%u,\"lat_max\":%u",
+		params, ops, bench_ns_per_op(start, end, ops), end>start ? double(ops)*1000.0/double(end-start) : 0.0,
+		h.percentile(50), h.percentile(90), h.percentile(99), h.percentile(99.9), h.maxval);
+}
+
+struct mpsc_producer_params {
+	bench_queue_t* q;
+	bench_qnode* nodes;
+	uint32_t id, count;
+};
+
+static void mpsc_producer_func(void* arg) {
+	mpsc_producer_params* p=(mpsc_producer_params*)arg;
+	uint32_t iter=0;
+	while(!start_flag.load(std::memory_order_acquire)) bench_spin(iter);
+	for(uint32_t i=0;i<p->count;i++) {
+		bench_qnode* node=&p->nodes[i];
+		node->producer=p->id;
+		node->seq=i;
+		node->sent=uv_hrtime();
+		p->q->push(node);
+	}
+}
+
+static inline void mpsc_consume(bench_qnode* node, uint64_t now, uint32_t* nextseq, iot_latency_histogram& h) {
+	if(node->seq!=nextseq[node->producer]) {
+		fprintf(stderr, "FIFO order broken for producer %u: got item %u instead of %u\n", node->producer, node->seq, nextseq[node->producer]);
+		exit(1);
+	}
+	nextseq[node->producer]++;
+	uint64_t lat=now>node->sent ? now-node->sent : 0;
+	h.record(lat>UINT32_MAX ? UINT32_MAX : uint32_t(lat));
+}
+
+static void run_mpsc(unsigned numproducers, bool use_popall, uint32_t count) {
+	bench_queue_t* q=new bench_queue_t;
+	uint32_t perproducer=count/numproducers;
+	uint64_t total=uint64_t(perproducer)*numproducers;
+	bench_qnode* nodes=(bench_qnode*)calloc(total, sizeof(bench_qnode));
+	iot_latency_histogram* h=new iot_latency_histogram;
+	if(!nodes || !h) {
+		fprintf(stderr, "Cannot allocate memory for %u queue items\n", unsigned(total));
+		exit(1);
+	}
+	h->clear();
+	mpsc_producer_params params[BENCH_QUEUE_MAXPRODUCERS];
+	uv_thread_t threads[BENCH_QUEUE_MAXPRODUCERS];
+	uint32_t nextseq[BENCH_QUEUE_MAXPRODUCERS]={};
+
+	start_flag.store(0, std::memory_order_relaxed);
+	for(unsigned i=0;i<numproducers;i++) {
+		params[i]={q, nodes+uint64_t(i)*perproducer, i, perproducer};
+		uv_thread_create(&threads[i], mpsc_producer_func, &params[i]);
+	}
+
+	uint64_t start=uv_hrtime(), received=0;
+	uint32_t iter=0;
+	start_flag.store(1, std::memory_order_release);
+	while(received<total) {
+		bench_qnode* node;
+		if(use_popall) {
+			node=q->pop_all();
+			if(!node) {bench_spin(iter); continue;}
+			uint64_t now=uv_hrtime();
+			do {
+				bench_qnode* next=node->next.load(std::memory_order_relaxed);
+				mpsc_consume(node, now, nextseq, *h);
+				received++;
+				node=next;
+			} while(node);
+		} else {
+			node=q->pop();
+			if(!node) {bench_spin(iter); continue;}
+			mpsc_consume(node, uv_hrtime(), nextseq, *h);
+			received++;
+		}
+	}
+	uint64_t end=uv_hrtime();
+	for(unsigned i=0;i<numproducers;i++) uv_thread_join(&threads[i]);
+
+	char paramsbuf[128];
+	snprintf(paramsbuf, sizeof(paramsbuf), "\"mode\":\"%s\",\"producers\":%u", use_popall ? "pop_all" : "pop", numproducers);
+	report_latency("mpsc_queue", paramsbuf, *h, total, start, end);
+
+	delete h;
+	free(nodes);
+	delete q;
+}
+
+static void run_mpsc_singlethread(uint32_t count) { //uncontended cost of push followed by pop
+	bench_queue_t* q=new bench_queue_t;
+	bench_qnode node={};
+	uint64_t start=uv_hrtime();
+	for(uint32_t i=0;i<count;i++) {
+		q->push(&node);
+		if(q->pop()!=&node) {
+			fprintf(stderr, "mpsc_queue returned wrong item\n");
+			exit(1);
+		}
+	}
+	uint64_t end=uv_hrtime();
+	bench_report("mpsc_queue_st", "\"count\":%u,\"ns_per_op\":%.1f", count, bench_ns_per_op(start, end, count));
+	delete q;
+}
+
+struct fifo_params {
+	byte_fifo_buf* fifo;
+	uint32_t msgsize, count;
+};
+
+static void fifo_writer_func(void* arg) {
+	fifo_params* p=(fifo_params*)arg;
+	char msg[BENCH_FIFO_MAXMSGSIZE];
+	memset(msg, 0x5A, p->msgsize);
+	uint32_t iter=0;
+	while(!start_flag.load(std::memory_order_acquire)) bench_spin(iter);
+	for(uint32_t i=0;i<p->count;i++) {
+		while(p->fifo->avail_write()<p->msgsize) bench_spin(iter); //messages are written in full to measure latency of whole message
+		uint64_t now=uv_hrtime();
+		memcpy(msg, &now, sizeof(now));
+		uint32_t n=p->fifo->write(msg, p->msgsize);
+		assert(n==p->msgsize);
+		(void)n;
+	}
+}
+
+static void run_fifo(uint8_t size_power, uint32_t msgsize, uint64_t totalbytes) {
+	assert(msgsize>=sizeof(uint64_t) && msgsize<=(1u<<size_power) && msgsize<=BENCH_FIFO_MAXMSGSIZE);
+	char* buf=(char*)malloc(size_t(1)<<size_power);
+	byte_fifo_buf* fifo=new byte_fifo_buf;
+	iot_latency_histogram* h=new iot_latency_histogram;
+	if(!buf || !fifo || !h) {
+		fprintf(stderr, "Cannot allocate memory for buffer of %u bytes\n", 1u<<size_power);
+		exit(1);
+	}
+	h->clear();
+	fifo->setbuf(size_power, buf);
+	uint32_t count=uint32_t(totalbytes/msgsize);
+	if(!count) count=1;
+	fifo_params p={fifo, msgsize, count};
+	char msg[BENCH_FIFO_MAXMSGSIZE];
+
+	start_flag.store(0, std::memory_order_relaxed);
+	uv_thread_t writer;
+	uv_thread_create(&writer, fifo_writer_func, &p);
+	uint64_t start=uv_hrtime();
+	uint32_t iter=0;
+	start_flag.store(1, std::memory_order_release);
+	for(uint32_t i=0;i<count;i++) {
+		while(fifo->pending_read()<msgsize) bench_spin(iter);
+		uint32_t n=fifo->read(msg, msgsize);
+		assert(n==msgsize);
+		(void)n;
+		uint64_t sent, now=uv_hrtime();
+		memcpy(&sent, msg, sizeof(sent));
+		uint64_t lat=now>sent ? now-sent : 0;
+		h->record(lat>UINT32_MAX ? UINT32_MAX : uint32_t(lat));
+	}
+	uint64_t end=uv_hrtime();
+	uv_thread_join(&writer);
+
+	double mbps=end>start ? double(count)*msgsize*1000.0/double(end-start) : 0.0; //bytes per ns * 1000 = MB/s
+	bench_report("byte_fifo_buf", "\"bufsize\":%u,\"msgsize\":%u,\"count\":%u,\"mb_per_s\":%.1f,\"ns_per_msg\":%.1f,\"lat_p50\":%u,\"lat_p90\":%u,\"lat_p99\":%u,\"lat_p999\":%u,\"lat_max\":%u",
+		1u<<size_power, msgsize, count, mbps, bench_ns_per_op(start, end, count),
+		h->percentile(50), h->percentile(90), h->percentile(99), h->percentile(99.9), h->maxval);
+
+	delete h;
+	delete fifo;
+	free(buf);
+}
+
+int main(int argc, char** argv) {
+	uint32_t count=argc>1 ? uint32_t(atoi(argv[1])) : 1000000;
+	if(!count) count=1000000;
+	unsigned maxproducers=argc>2 ? unsigned(atoi(argv[2])) : 8;
+	if(!maxproducers) maxproducers=8;
+	if(maxproducers>BENCH_QUEUE_MAXPRODUCERS) maxproducers=BENCH_QUEUE_MAXPRODUCERS;
+
+	run_mpsc_singlethread(count);
+	for(unsigned n=1;;n=n*2<maxproducers ? n*2 : maxproducers) { //powers of two and exact maxproducers
+		run_mpsc(n, false, count);
+		run_mpsc(n, true, count);
+		if(n>=maxproducers) break;
+	}
+
+	static const uint8_t bufpowers[]={12, 16, 20}; //4K, 64K, 1M
+	static const uint32_t msgsizes[]={16, 256, 4096};
+	uint64_t totalbytes=uint64_t(count)*256;
+	for(unsigned b=0;b<sizeof(bufpowers)/sizeof(bufpowers[0]);b++)
+		for(unsigned m=0;m<sizeof(msgsizes)/sizeof(msgsizes[0]);m++) {
+			if(msgsizes[m]>(1u<<bufpowers[b])) continue;
+			run_fifo(bufpowers[b], msgsizes[m], totalbytes);
+		}
+	return 0;
+}
@@ -0,0 +1,74 @@
+//Measures cost of releasing memory blocks from thread other than owner of allocator with and without batching of remote releases.
+//Producer thread allocates blocks and passes them to consumer thread which releases them and flushes its remote release cache
+//after every 'iteration' blocks (like kernel threads do after every event loop iteration).
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_common.h"
+
+struct remotefree_params {
+	iot_memallocator* allocator;
+	bench_ptr_channel* chan;
+	uint32_t size, count, iteration;
+};
+
+static void producer_func(void* arg) {
+	remotefree_params* p=(remotefree_params*)arg;
+	p->allocator->set_thread(uv_thread_self());
+	for(uint32_t i=0;i<p->count;i++) {
+		void* ptr;
+		while(!(ptr=p->allocator->allocate(p->size))) sched_yield();
+		p->chan->send(ptr);
+	}
+}
+
+static void consumer_func(void* arg) {
+	remotefree_params* p=(remotefree_params*)arg;
+	iot_memallocator own; //remote releases are batched by threads with own allocator only (like kernel threads)
+	iot_thread_item_t::current_allocator=&own;
+	own.set_thread(uv_thread_self());
+	for(uint32_t i=0;i<p->count;i++) {
+		iot_release_memblock(p->chan->recv());
+		if((i+1) % p->iteration==0) iot_memallocator::flush_remote_releases();
+	}
+	iot_memallocator::flush_remote_releases();
+	iot_thread_item_t::current_allocator=NULL;
+}
+
+static void run(uint32_t batch, uint32_t size, uint32_t count, uint32_t iteration) {
+	iot_memallocator::set_remotefree_batch(batch);
+	iot_memallocator allocator;
+	bench_ptr_channel* chan=new bench_ptr_channel;
+	remotefree_params p={&allocator, chan, size, count, iteration};
+
+	uv_thread_t prod, cons;
+	uint64_t start=uv_hrtime();
+	uv_thread_create(&cons, consumer_func, &p);
+	uv_thread_create(&prod, producer_func, &p);
+	uv_thread_join(&prod);
+	uv_thread_join(&cons);
+	uint64_t end=uv_hrtime();
+
+	iot_memstats_t st;
+	allocator.get_stats(&st);
+	uint64_t misses=0;
+	for(int i=0;i<IOT_MEMSTATS_NUMLISTS;i++) misses+=st.lists[i].misses;
+
+	bench_report("remotefree", "\"batch\":%u,\"size\":%u,\"count\":%u,\"iteration\":%u,\"ns_per_op\":%.1f,\"misses\":%" PRIu64,
+		batch, size, count, iteration, bench_ns_per_op(start, end, count), misses);
+
+	allocator.set_thread(uv_thread_self());
+	delete chan;
+}
+
+int main(int argc, char** argv) {
+	uint32_t count=argc>1 ? uint32_t(atoi(argv[1])) : 2000000;
+	if(!count) count=2000000;
+	static const uint32_t sizes[]={32, 100, 400};
+	static const uint32_t batches[]={1, 8, IOT_MEMALLOC_REMOTEFREE_BATCH, 128};
+	for(unsigned s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++)
+		for(unsigned b=0;b<sizeof(batches)/sizeof(batches[0]);b++)
+			run(batches[b], sizes[s], count, 256);
+	return 0;
+}
@@ -0,0 +1,23 @@
+//Minimal definitions of kernel globals which are necessary to link kernel sources outside of daemon
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "uv.h"
+#include "iot_module.h"
+#include "iot_kernel.h"
+
+iot_thread_registry_t* thread_registry=NULL; //benchmarks use iot_memallocator objects directly
+thread_local iot_thread_item_t* iot_thread_item_t::current=NULL;
+thread_local iot_memallocator* iot_thread_item_t::current_allocator=NULL;
+thread_local uv_loop_t* iot_thread_item_t::current_loop=NULL;
+uv_thread_t main_thread=uv_thread_self();
+int min_loglevel=LERROR;
+
+void do_outlog(const char*file, int line, const char* func, int level, const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	fprintf(stderr, "%s:%d %s(): ", file, line, func);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}